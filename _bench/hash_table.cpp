@@ -0,0 +1,317 @@
+#include "../code/hash_table.h"
+
+#include <cstdio>
+#include <climits>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <new>
+#include <mutex>
+#include <thread>
+#include <atomic>
+using namespace std;
+using namespace chrono;
+// Benchmarks for code/hash_table.h
+// g++ -std=c++14 -O2 -march=native -pthread hash_table.cpp -o hash_table
+
+// Atomic because bench_concurrent allocates from several threads.
+atomic<size_t> bytes_of_new(0);
+
+void * operator new(size_t n)
+{
+    bytes_of_new.fetch_add(n, memory_order_relaxed);
+    return malloc(n);
+}
+
+void operator delete(void * p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void * p, size_t) noexcept
+{
+    free(p);
+}
+
+struct int_hash {
+    int operator()(int x) const { return x & INT_MAX; }
+};
+
+mt19937 gen(20181101);
+
+template <typename F>
+double measure(F f)
+{
+    time_point<steady_clock> start = steady_clock::now();
+    f();
+    return duration<double, milli>(steady_clock::now() - start).count();
+}
+
+void print(const char * name, int ops, double ms)
+{
+    printf("%-36s %9.1f ms %8.2f ns/op\n", name, ms, ms * 1e6 / ops);
+}
+
+// find() one key at a time vs. find_batch() over the same keys.
+void bench_find_batch(int n, int q)
+{
+    typedef dictionary<int, int, int_hash> dict;
+    dict d;
+    vector<int> keys(n);
+    for (int i = 0; i < n; i++) {
+        keys[i] = gen() & INT_MAX;
+        d.insert(keys[i], i);
+    }
+    vector<int> qs(q);
+    for (int i = 0; i < q; i++)
+        qs[i] = (i & 1) ? keys[gen() % n] : int(gen() & INT_MAX);
+    const int B = 1024;
+    vector<dict::iterator> out(B);
+    long long sum = 0;
+    printf("find vs. find_batch: %d keys, %d queries\n", n, q);
+    print("find", q, measure([&] {
+        for (int i = 0; i < q; i++) {
+            dict::iterator u = d.find(qs[i]);
+            if (u != d.end()) sum += u->value();
+        }
+    }));
+    print("find_batch", q, measure([&] {
+        for (int s = 0; s < q; s += B) {
+            d.find_batch(qs.data() + s, min(B, q - s), out.data());
+            for (int i = 0; i < B && s + i < q; i++)
+                if (out[i] != d.end()) sum += out[i]->value();
+        }
+    }));
+    vector<int> vs(n);
+    print("insert (presized)", n, measure([&] {
+        dict e(n);
+        for (int i = 0; i < n; i++) e.insert(keys[i], i);
+        sum += e.size();
+    }));
+    print("insert_batch (presized)", n, measure([&] {
+        dict e(n);
+        e.insert_batch(keys.data(), vs.data(), n);
+        sum += e.size();
+    }));
+    printf("(checksum %lld)\n\n", sum);
+}
+
+// dictionary vs. frozen_dictionary built from it: hits and misses.
+void bench_frozen(int n, int q)
+{
+    typedef dictionary<int, int, int_hash> dict;
+    typedef frozen_dictionary<int, int, int_hash> frozen;
+    dict d;
+    vector<int> keys(n);
+    for (int i = 0; i < n; i++) {
+        keys[i] = gen() & INT_MAX;
+        d.insert(keys[i], i);
+    }
+    vector<int> qs(q);
+    for (int i = 0; i < q; i++)
+        qs[i] = (i & 1) ? keys[gen() % n] : int(gen() & INT_MAX);
+    long long sum = 0;
+    printf("dictionary vs. frozen_dictionary: %d keys, %d queries\n", n, q);
+    frozen * f = NULL;
+    print("frozen_dictionary build", n, measure([&] { f = new frozen(d); }));
+    print("dictionary find", q, measure([&] {
+        for (int i = 0; i < q; i++) {
+            dict::iterator u = d.find(qs[i]);
+            if (u != d.end()) sum += u->value();
+        }
+    }));
+    print("frozen_dictionary find", q, measure([&] {
+        for (int i = 0; i < q; i++) {
+            frozen::iterator u = f->find(qs[i]);
+            if (u != f->end()) sum += u->value();
+        }
+    }));
+    delete f;
+    printf("(checksum %lld)\n\n", sum);
+}
+
+// Rebuilding a dictionary by inserts vs. mapping a saved snapshot.
+void bench_snapshot(int n, int q)
+{
+    typedef dictionary<int, int, int_hash> dict;
+    const char * path = "hash_table.snapshot";
+    vector<int> keys(n);
+    for (int i = 0; i < n; i++)
+        keys[i] = gen() & INT_MAX;
+    long long sum = 0;
+    printf("dictionary rebuild vs. load: %d keys\n", n);
+    {
+        dict d;
+        print("rebuild by insert", n, measure([&] {
+            for (int i = 0; i < n; i++) d.insert(keys[i], i);
+        }));
+        print("save", n, measure([&] { sum += d.save(path); }));
+    }
+    dict d;
+    print("load", n, measure([&] { sum += d.load(path); }));
+    print("first finds after load", q, measure([&] {
+        for (int i = 0; i < q; i++) sum += d.find(keys[gen() % n])->value();
+    }));
+    remove(path);
+    printf("(checksum %lld)\n\n", sum);
+}
+
+// Miss-heavy lookups (90% absent keys) on a plain dictionary and on
+// dictionaries fronted by a Bloom or a cuckoo filter.
+template <typename D>
+void bench_filtered_find(const char * name, const vector<int> & keys, const vector<int> & qs)
+{
+    D d;
+    for (int i = 0; i < (int) keys.size(); i++) d.insert(keys[i], i);
+    long long sum = 0;
+    print(name, qs.size(), measure([&] {
+        for (int i = 0; i < (int) qs.size(); i++) {
+            typename D::iterator u = d.find(qs[i]);
+            if (u != d.end()) sum += u->value();
+        }
+    }));
+    printf("(checksum %lld)\n", sum);
+}
+
+template <typename F>
+void bench_filter_rate(const char * name, int n, double fpr)
+{
+    F f(n, fpr);
+    for (int i = 0; i < n; i++) f.insert(i);
+    int c = 0;
+    for (int i = n; i < 2 * n; i++) c += f.contains(i);
+    printf("%-36s target %.4f measured %.4f\n", name, fpr, double(c) / n);
+}
+
+void bench_filters(int n, int q)
+{
+    typedef blocked_bloom_filter<int, int_hash> bloom;
+    typedef cuckoo_filter<int, int_hash> cuckoo;
+    vector<int> keys(n);
+    for (int i = 0; i < n; i++)
+        keys[i] = gen() & INT_MAX;
+    vector<int> qs(q);
+    for (int i = 0; i < q; i++)
+        qs[i] = i % 10 == 0 ? keys[gen() % n] : int(gen() & INT_MAX);
+    printf("miss-heavy find: %d keys, %d queries, 90%% misses\n", n, q);
+    bench_filtered_find<dictionary<int, int, int_hash> >("dictionary", keys, qs);
+    bench_filtered_find<filtered_dictionary<int, int, int_hash, bloom> >("dictionary + blocked_bloom_filter", keys, qs);
+    bench_filtered_find<filtered_dictionary<int, int, int_hash, cuckoo> >("dictionary + cuckoo_filter", keys, qs);
+    for (double p = 0.1; p > 0.0005; p /= 10) {
+        bench_filter_rate<bloom>("blocked_bloom_filter", n, p);
+        bench_filter_rate<cuckoo>("cuckoo_filter", n, p);
+    }
+    printf("\n");
+}
+
+// skip_list (one node per level) vs. compact_skip_list (one tower per key).
+template <typename L>
+void bench_skip_list(const char * name, const vector<int> & keys)
+{
+    int n = keys.size();
+    long long sum = 0;
+    size_t bytes = bytes_of_new;
+    L * l = new L;
+    char buf[64];
+    sprintf(buf, "%s insert", name);
+    print(buf, n, measure([&] {
+        for (int i = 0; i < n; i++) l->insert(keys[i], i);
+    }));
+    printf("%-36s %9.1f bytes/key\n", name, double(bytes_of_new - bytes) / n);
+    sprintf(buf, "%s find", name);
+    print(buf, n, measure([&] {
+        for (int i = 0; i < n; i++) sum += l->find(keys[i])->value();
+    }));
+    sprintf(buf, "%s erase/insert", name);
+    print(buf, n, measure([&] {
+        for (int i = 0; i < n; i++) {
+            l->erase(keys[i]);
+            l->insert(keys[i], i);
+        }
+    }));
+    sprintf(buf, "%s scan", name);
+    print(buf, n, measure([&] {
+        for (typename L::iterator u = l->begin(); u != l->end(); ++u)
+            sum += u->value();
+    }));
+    delete l;
+    printf("(checksum %lld)\n", sum);
+}
+
+// Mixed workload on one shared ordered map from several threads:
+// 50% find, 25% insert, 25% erase, over a fixed key range.
+struct locked_skip_list {
+    mutex lock;
+    compact_skip_list<int, int> l;
+    bool find(int k) {
+        lock_guard<mutex> g(lock);
+        return l.find(k) != l.end();
+    }
+    bool insert(int k, int v) {
+        lock_guard<mutex> g(lock);
+        return l.insert(k, v) != l.end();
+    }
+    void erase(int k) {
+        lock_guard<mutex> g(lock);
+        l.erase(k);
+    }
+};
+
+struct lock_free_skip_list {
+    concurrent_skip_list<int, int> l;
+    bool find(int k) { return l.contains(k); }
+    bool insert(int k, int v) { return l.insert(k, v); }
+    void erase(int k) { l.erase(k); }
+};
+
+template <typename L>
+void bench_concurrent(const char * name, int threads, int ops, int range)
+{
+    L l;
+    for (int i = 0; i < range; i += 2) l.insert(i, i);
+    atomic<long long> hits(0);
+    double ms = measure([&] {
+        vector<thread> ts;
+        for (int t = 0; t < threads; t++)
+            ts.push_back(thread([&, t] {
+                mt19937 g(t);
+                long long h = 0;
+                for (int i = 0; i < ops; i++) {
+                    int k = g() % range, op = g() % 4;
+                    if (op < 2) h += l.find(k);
+                    else if (op == 2) l.insert(k, i);
+                    else l.erase(k);
+                }
+                hits += h;
+            }));
+        for (int t = 0; t < threads; t++) ts[t].join();
+    });
+    printf("%-24s %2d threads %9.1f ms %8.2f Mops/s\n",
+           name, threads, ms, threads * double(ops) / ms / 1e3);
+}
+
+int main()
+{
+    bench_find_batch(1 << 22, 1 << 23);
+    bench_frozen(1 << 22, 1 << 23);
+    bench_snapshot(1 << 22, 1 << 16);
+    bench_filters(1 << 22, 1 << 23);
+
+    vector<int> keys(1 << 20);
+    for (int i = 0; i < (int) keys.size(); i++)
+        keys[i] = i;
+    shuffle(keys.begin(), keys.end(), gen);
+    printf("skip_list vs. compact_skip_list: %d keys\n", (int) keys.size());
+    bench_skip_list<skip_list<int, int> >("skip_list", keys);
+    bench_skip_list<compact_skip_list<int, int> >("compact_skip_list", keys);
+    printf("\n");
+
+    printf("mutex + compact_skip_list vs. concurrent_skip_list (%u hardware threads)\n",
+           thread::hardware_concurrency());
+    for (int t = 1; t <= 8; t <<= 1) {
+        bench_concurrent<locked_skip_list>("mutex + skip list", t, 1 << 18, 1 << 20);
+        bench_concurrent<lock_free_skip_list>("concurrent_skip_list", t, 1 << 18, 1 << 20);
+    }
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,256 @@
+#include "../code/heap.h"
+
+#include <cstdio>
+#include <climits>
+#include <vector>
+#include <queue>
+#include <chrono>
+#include <random>
+#include <new>
+using namespace std;
+using namespace chrono;
+// Benchmarks for code/heap.h
+// g++ -std=c++14 -O2 -march=native heap.cpp -o heap
+
+size_t calls_of_new = 0;
+
+void * operator new(size_t n)
+{
+    calls_of_new++;
+    return malloc(n);
+}
+
+void operator delete(void * p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void * p, size_t) noexcept
+{
+    free(p);
+}
+
+mt19937 gen(20181101);
+
+template <typename F>
+double measure(F f)
+{
+    time_point<steady_clock> start = steady_clock::now();
+    f();
+    return duration<double, milli>(steady_clock::now() - start).count();
+}
+
+void print(const char * name, int ops, double ms)
+{
+    printf("%-36s %9.1f ms %8.2f ns/op\n", name, ms, ms * 1e6 / ops);
+}
+
+// A random directed graph in compressed rows: n vertices, m edges.
+struct graph {
+    vector<int> head, to, weight;
+    graph(int n, int m, int max_weight) : head(n + 1), to(m), weight(m) {
+        vector<int> from(m);
+        for (int i = 0; i < m; i++) {
+            from[i] = gen() % n;
+            head[from[i] + 1]++;
+        }
+        for (int u = 0; u < n; u++) head[u + 1] += head[u];
+        vector<int> next(head.begin(), head.end() - 1);
+        for (int i = 0; i < m; i++) {
+            int j = next[from[i]]++;
+            to[j] = gen() % n;
+            weight[j] = gen() % max_weight + 1;
+        }
+    }
+    int size() const { return head.size() - 1; }
+};
+
+// Dijkstra with lazy deletion: an improved vertex is pushed again and the
+// stale entries are skipped when they reach the top, so the heap can hold
+// up to E entries.
+template <typename H>
+long long dijkstra_lazy(const graph & g, vector<int> & dist, int * peak)
+{
+    typedef pair<int, int> item;
+    H q;
+    fill(dist.begin(), dist.end(), INT_MAX);
+    dist[0] = 0;
+    q.push(item(0, 0));
+    int size = 1;
+    long long pops = 0;
+    *peak = 1;
+    while (!q.empty()) {
+        item p = q.top();
+        q.pop();
+        size--;
+        pops++;
+        int u = p.second;
+        if (dist[u] < p.first) continue;
+        for (int i = g.head[u]; i < g.head[u + 1]; i++) {
+            int v = g.to[i], d = dist[u] + g.weight[i];
+            if (d < dist[v]) {
+                dist[v] = d;
+                q.push(item(d, v));
+                *peak = max(*peak, ++size);
+            }
+        }
+    }
+    return pops;
+}
+
+template <int D>
+long long dijkstra_indexed(const graph & g, vector<int> & dist, int * peak)
+{
+    indexed_heap<int, D> q(g.size());
+    fill(dist.begin(), dist.end(), INT_MAX);
+    dist[0] = 0;
+    q.push(0, 0);
+    long long pops = 0;
+    *peak = 1;
+    while (!q.empty()) {
+        int u = q.top();
+        q.pop();
+        pops++;
+        for (int i = g.head[u]; i < g.head[u + 1]; i++) {
+            int v = g.to[i], d = dist[u] + g.weight[i];
+            if (d < dist[v]) {
+                dist[v] = d;
+                if (q.contains(v)) q.decrease_key(v, d);
+                else q.push(v, d);
+            }
+        }
+        *peak = max(*peak, q.size());
+    }
+    return pops;
+}
+
+long long dijkstra_pairing(const graph & g, vector<int> & dist, int * peak)
+{
+    typedef pairing_heap<pair<int, int> > heap;
+    heap q;
+    vector<heap::position> at(g.size(), NULL);
+    fill(dist.begin(), dist.end(), INT_MAX);
+    dist[0] = 0;
+    at[0] = q.push(make_pair(0, 0));
+    long long pops = 0;
+    *peak = 1;
+    while (!q.empty()) {
+        int u = q.top().second;
+        q.pop();
+        pops++;
+        for (int i = g.head[u]; i < g.head[u + 1]; i++) {
+            int v = g.to[i], d = dist[u] + g.weight[i];
+            if (d < dist[v]) {
+                if (dist[v] == INT_MAX) at[v] = q.push(make_pair(d, v));
+                else q.decrease_key(at[v], make_pair(d, v));
+                dist[v] = d;
+            }
+        }
+        *peak = max(*peak, q.size());
+    }
+    return pops;
+}
+
+template <typename F>
+void bench_one(const char * name, const graph & g, const vector<int> & expected, F f)
+{
+    vector<int> dist(g.size());
+    long long pops = 0;
+    int peak = 0;
+    double ms = measure([&] { pops = f(g, dist, &peak); });
+    printf("%-36s %9.1f ms %8.2f ns/edge  %9lld pops  %9d peak%s\n", name, ms,
+           ms * 1e6 / g.to.size(), pops, peak, dist == expected ? "" : "  WRONG");
+}
+
+// Single-source shortest paths on one graph with every heap. Small weights
+// produce many ties, large ones many improvements and so many stale
+// entries for the lazy heaps.
+void bench_dijkstra(int n, int m, int max_weight)
+{
+    graph g(n, m, max_weight);
+    vector<int> expected(n);
+    int peak;
+    dijkstra_lazy<priority_queue<pair<int, int>, vector<pair<int, int> >,
+                                 greater<pair<int, int> > > >(g, expected, &peak);
+    printf("dijkstra: %d vertices, %d edges, weights in [1, %d]\n", n, m, max_weight);
+    bench_one("std::priority_queue (lazy)", g, expected,
+              dijkstra_lazy<priority_queue<pair<int, int>, vector<pair<int, int> >,
+                                           greater<pair<int, int> > > >);
+    bench_one("binary_heap (lazy)", g, expected,
+              dijkstra_lazy<binary_heap<pair<int, int> > >);
+    bench_one("indexed_heap D = 2", g, expected, dijkstra_indexed<2>);
+    bench_one("indexed_heap D = 4", g, expected, dijkstra_indexed<4>);
+    bench_one("indexed_heap D = 8", g, expected, dijkstra_indexed<8>);
+    bench_one("pairing_heap", g, expected, dijkstra_pairing);
+    printf("\n");
+}
+
+// Heap operations alone: n ids are pushed, then q rounds each lower the
+// key of a random id, pop the top and push it back with a larger key.
+template <int D>
+void bench_decrease_key(int n, int q, const vector<int> & ids, const vector<int> & keys)
+{
+    indexed_heap<long long, D> h(n);
+    long long sum = 0;
+    char buf[64];
+    sprintf(buf, "indexed_heap D = %d", D);
+    print(buf, q, measure([&] {
+        for (int i = 0; i < n; i++) h.push(i, keys[i]);
+        for (int i = 0; i < q; i++) {
+            int v = ids[i];
+            h.decrease_key(v, h.key(v) - keys[i]);
+            int u = h.top();
+            long long k = h.top_key();
+            sum += k;
+            h.pop();
+            h.push(u, k + 2 * keys[i]);
+        }
+    }));
+    printf("(checksum %lld)\n", sum);
+}
+
+// n random pushes then n pops, with the calls to operator new, and the
+// time to clear a pairing heap of m ascending keys, which is one long
+// sibling list under the root.
+void bench_push_pop(int n, int m)
+{
+    vector<int> keys(n);
+    for (int i = 0; i < n; i++) keys[i] = gen();
+    long long sum = 0;
+    printf("push + pop: %d keys\n", n);
+    size_t calls = calls_of_new;
+    print("std::priority_queue", n, measure([&] {
+        priority_queue<int, vector<int>, greater<int> > q;
+        for (int i = 0; i < n; i++) q.push(keys[i]);
+        for ( ; !q.empty(); q.pop()) sum += q.top();
+    }));
+    printf("%-36s %9zu calls of new\n", "", calls_of_new - calls);
+    calls = calls_of_new;
+    print("pairing_heap", n, measure([&] {
+        pairing_heap<int> q;
+        for (int i = 0; i < n; i++) q.push(keys[i]);
+        for ( ; !q.empty(); q.pop()) sum += q.top();
+    }));
+    printf("%-36s %9zu calls of new\n", "", calls_of_new - calls);
+    pairing_heap<int> q;
+    for (int i = 0; i < m; i++) q.push(i);
+    print("pairing_heap clear (ascending keys)", m, measure([&] { q.clear(); }));
+    printf("(checksum %lld)\n\n", sum);
+}
+
+int main()
+{
+    bench_dijkstra(1 << 17, 1 << 20, 100);
+    bench_dijkstra(1 << 17, 1 << 20, 1 << 20);
+    bench_dijkstra(1 << 14, 1 << 22, 1 << 20);
+    bench_push_pop(1 << 20, 1 << 24);
+    int n = 1 << 18, q = 1 << 21;
+    vector<int> ids(q), keys(max(n, q));
+    for (int i = 0; i < q; i++) ids[i] = gen() % n;
+    for (int i = 0; i < (int) keys.size(); i++) keys[i] = gen() % (1 << 20);
+    printf("decrease_key + pop + push: %d ids, %d rounds\n", n, q);
+    bench_decrease_key<2>(n, q, ids, keys);
+    bench_decrease_key<4>(n, q, ids, keys);
+    bench_decrease_key<8>(n, q, ids, keys);
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include "../code/search_tree.h"
+
+#include <cstdio>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+using namespace std;
+using namespace chrono;
+// Benchmarks for code/search_tree.h
+// g++ -std=c++14 -O2 -march=native -pthread search_tree.cpp -o search_tree
+
+mt19937 gen(20181101);
+
+template <typename F>
+double measure(F f)
+{
+    time_point<steady_clock> start = steady_clock::now();
+    f();
+    return duration<double, milli>(steady_clock::now() - start).count();
+}
+
+void print(const char * name, int ops, double ms)
+{
+    printf("%-36s %9.1f ms %8.2f ns/op\n", name, ms, ms * 1e6 / ops);
+}
+
+// Insert/erase churn: n keys live at any time; every step erases a random
+// live key and inserts a fresh one. Reports the time and the number of
+// calls to operator new.
+template <typename T>
+void bench_churn(const char * name, int n, int steps)
+{
+    vector<int> live(n);
+    for (int i = 0; i < n; i++)
+        live[i] = gen() & INT_MAX;
+    T * t = new T;
+    int news = times_of_new;
+    print((string(name) + " fill").c_str(), n, measure([&] {
+        for (int i = 0; i < n; i++) t->insert(live[i], i);
+    }));
+    print((string(name) + " churn").c_str(), steps, measure([&] {
+        for (int i = 0; i < steps; i++) {
+            int j = gen() % n;
+            t->erase(live[j]);
+            live[j] = gen() & INT_MAX;
+            t->insert(live[j], i);
+        }
+    }));
+    long long sum = 0;
+    print((string(name) + " scan").c_str(), t->size(), measure([&] {
+        for (typename T::iterator u = t->begin(); u != t->end(); ++u)
+            sum += u->value();
+    }));
+    print((string(name) + " destroy").c_str(), t->size(), measure([&] { delete t; }));
+    printf("%-36s %9d calls to new (checksum %lld)\n", name, times_of_new - news, sum);
+}
+
+// Loading n sorted (key, value) pairs: one insert per key vs.
+// build_from_sorted, each into a fresh tree.
+template <typename T>
+void bench_build(const char * name, int n)
+{
+    vector<pair<int, int> > v(n);
+    for (int i = 0; i < n; i++)
+        v[i] = make_pair(i * 2, i);
+    T s, t;
+    print((string(name) + " insert sorted").c_str(), n, measure([&] {
+        for (int i = 0; i < n; i++) s.insert(v[i].first, v[i].second);
+    }));
+    print((string(name) + " build_from_sorted").c_str(), n, measure([&] {
+        t.build_from_sorted(v.begin(), v.end());
+    }));
+}
+
+// Union of a treap of n keys with one of m keys: set_union vs. inserting
+// the smaller one key by key. Both trees are rebuilt for every run.
+void bench_union(int n, int m)
+{
+    vector<pair<int, int> > a(n), b(m);
+    for (int i = 0; i < n; i++)
+        a[i] = make_pair(i * 2, i);
+    for (int i = 0; i < m; i++)
+        b[i] = make_pair((int) ((long long) i * 2 * n / m) + (i & 1), i);
+    treap<int, int> s, t;
+    char name[64];
+    s.build_from_sorted(a.begin(), a.end());
+    t.build_from_sorted(b.begin(), b.end());
+    sprintf(name, "n=%d m=%d insert", n, m);
+    print(name, m, measure([&] {
+        for (treap<int, int>::iterator u = t.begin(); u != t.end(); ++u)
+            s.insert(u->key(), u->value());
+    }));
+    s.build_from_sorted(a.begin(), a.end());
+    sprintf(name, "n=%d m=%d set_union", n, m);
+    print(name, m, measure([&] { s.set_union(t); }));
+}
+
+// n random keys: random successful lookups, then range scans of `len`
+// entries starting at random keys.
+template <typename T>
+void bench_lookup(const char * name, int n, int lookups, int len)
+{
+    vector<int> keys(n);
+    for (int i = 0; i < n; i++)
+        keys[i] = gen() & INT_MAX;
+    T t;
+    for (int i = 0; i < n; i++) t.insert(keys[i], i);
+    long long sum = 0;
+    print((string(name) + " find").c_str(), lookups, measure([&] {
+        for (int i = 0; i < lookups; i++)
+            sum += t.find(keys[gen() % n])->value();
+    }));
+    int scans = lookups / len;
+    print((string(name) + " range scan").c_str(), scans * len, measure([&] {
+        for (int i = 0; i < scans; i++) {
+            typename T::iterator u = t.find(keys[gen() % n]);
+            for (int j = 0; j < len && u != t.end(); j++, ++u)
+                sum += u->value();
+        }
+    }));
+    printf("%-36s %9lld checksum\n", name, sum);
+}
+
+// A writer doing `steps` random updates on n keys and taking a snapshot
+// every `every` updates: copying an avl_tree vs. persistent_avl_tree.
+void bench_snapshot(int n, int steps, int every)
+{
+    avl_tree<int, int> a;
+    persistent_avl_tree<int, int> p;
+    for (int i = 0; i < n; i++) {
+        a.insert(i, i);
+        p.insert(i, i);
+    }
+    vector<avl_tree<int, int> > as;
+    vector<persistent_avl_tree<int, int> > ps;
+    print("avl_tree update + copy", steps, measure([&] {
+        for (int i = 0; i < steps; i++) {
+            int k = gen() % n;
+            a.erase(k);
+            a.insert(k, i);
+            if (i % every == 0) as.push_back(a);
+        }
+    }));
+    print("persistent_avl_tree update + snap", steps, measure([&] {
+        for (int i = 0; i < steps; i++) {
+            int k = gen() % n;
+            p.assign(k, i);
+            if (i % every == 0) ps.push_back(p.snapshot());
+        }
+    }));
+    printf("%-36s %9d snapshots\n", "", (int) ps.size());
+}
+
+int main()
+{
+    const int n = 1 << 18, steps = 1 << 19;
+    printf("insert/erase churn, slab_pool vs. heap_allocator: %d keys, %d steps\n", n, steps);
+    bench_churn<search_tree<int, int> >("search_tree", n, steps);
+    bench_churn<search_tree<int, int, heap_allocator> >("search_tree (heap)", n, steps);
+    bench_churn<splay_tree<int, int> >("splay_tree", n, steps);
+    bench_churn<splay_tree<int, int, heap_allocator> >("splay_tree (heap)", n, steps);
+    bench_churn<treap<int, int> >("treap", n, steps);
+    bench_churn<treap<int, int, heap_allocator> >("treap (heap)", n, steps);
+    bench_churn<avl_tree<int, int> >("avl_tree", n, steps);
+    bench_churn<avl_tree<int, int, heap_allocator> >("avl_tree (heap)", n, steps);
+    bench_churn<rb_tree<int, int> >("rb_tree", n, steps);
+    bench_churn<rb_tree<int, int, heap_allocator> >("rb_tree (heap)", n, steps);
+    printf("\n");
+    printf("bulk load of sorted keys: %d keys\n", 1 << 20);
+    bench_build<avl_tree<int, int> >("avl_tree", 1 << 20);
+    bench_build<rb_tree<int, int> >("rb_tree", 1 << 20);
+    bench_build<treap<int, int> >("treap", 1 << 20);
+    printf("\n");
+    printf("random lookups and range scans of 100 entries: %d keys\n", 1 << 22);
+    bench_lookup<b_tree<int, int> >("b_tree", 1 << 22, 1 << 22, 100);
+    bench_lookup<rb_tree<int, int> >("rb_tree", 1 << 22, 1 << 22, 100);
+    printf("\n");
+    printf("snapshots: %d keys, one per %d updates\n", 1 << 18, 1 << 12);
+    bench_snapshot(1 << 18, 1 << 16, 1 << 12);
+    printf("\n");
+    printf("treap union (ns/op per key of the smaller tree)\n");
+    for (int m = 1 << 10; m <= 1 << 20; m <<= 5)
+        bench_union(1 << 20, m);
+    printf("\n");
+    return 0;
+}
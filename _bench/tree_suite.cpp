@@ -0,0 +1,252 @@
+// tree.h is written for contests: it expects the whole standard library in
+// scope and defines N, INF and class names that search_tree.h also uses,
+// so it is included last, inside its own namespace.
+#include <bits/stdc++.h>
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+#include <malloc.h>
+#define TREE_STATS
+#include "../code/search_tree.h"
+namespace contest {
+#include "../code/tree.h"
+}
+using namespace std;
+using namespace chrono;
+// Comparative benchmarks for the ordered maps of code/search_tree.h and
+// code/tree.h, with std::map and the pbds rb-tree as baselines.
+// g++ -std=c++14 -O2 -march=native -pthread tree_suite.cpp -o tree_suite
+// ./tree_suite [keys] [ops]
+
+mt19937 gen(20181101);
+
+enum { READ, INSERT, ERASE };
+struct op {
+    int type;
+    int key;
+};
+
+// One interface over all the maps: insert leaves an existing key alone,
+// and erase of a missing key does nothing. COUNTED tells whether the map
+// reports its rotations through COUNT_ROTATIONS; b_tree splits and merges
+// nodes instead, so it does not.
+template <typename T, int C = 1>
+struct scl_map {
+    enum { COUNTED = C };
+    T t;
+    void insert(int k, int v) { t.insert(k, v); }
+    bool find(int k) { return t.find(k) != t.end(); }
+    void erase(int k) { t.erase(k); }
+};
+struct std_map {
+    enum { COUNTED = 0 };
+    map<int, int> t;
+    void insert(int k, int v) { t.emplace(k, v); }
+    bool find(int k) { return t.find(k) != t.end(); }
+    void erase(int k) { t.erase(k); }
+};
+struct pbds_map {
+    enum { COUNTED = 0 };
+    __gnu_pbds::tree<int, int, less<int>, __gnu_pbds::rb_tree_tag,
+                     __gnu_pbds::tree_order_statistics_node_update> t;
+    void insert(int k, int v) { t.insert(make_pair(k, v)); }
+    bool find(int k) { return t.find(k) != t.end(); }
+    void erase(int k) { t.erase(k); }
+};
+struct contest_avl {
+    enum { COUNTED = 1 };
+    contest::avl_tree<int> t;
+    void insert(int k, int) { t.insert(k); }
+    bool find(int k) { return t.contain(k); }
+    void erase(int k) { t.erase(k); }
+};
+// TREAP::treap is a multiset of at most N - 1 nodes with no lookup, so
+// reads are rank queries instead. It relies on the zeroed memory of a
+// global, hence t().
+struct contest_treap {
+    enum { COUNTED = 1 };
+    contest::TREAP::treap t;
+    contest_treap() : t() { t.init(); }
+    void insert(int k, int) { t.insert(k); }
+    bool find(int k) { return t.get_kth(k / 2 + 1) >= 0; }
+    void erase(int k) { t.erase(k); }
+};
+
+// Keys live in [0, 2n), half of them present: a write inserts or erases
+// with equal odds. Sequential walks the key space in order; Zipfian draws
+// ranks with exponent 0.99 and scatters them over the keys. The sliding
+// window inserts t + n and erases t for every pair of writes, and reads
+// keys inside the window.
+struct workload {
+    string name;
+    vector<int> fill;
+    vector<op> ops;
+};
+
+workload make_workload(const string & kind, double reads, int n, int m)
+{
+    workload w;
+    char buf[64];
+    sprintf(buf, "%s, %d%% reads", kind.c_str(), (int) (reads * 100 + 0.5));
+    w.name = buf;
+    vector<int> perm(2 * n);
+    iota(perm.begin(), perm.end(), 0);
+    shuffle(perm.begin(), perm.end(), gen);
+    vector<double> cdf;
+    if (kind == "zipfian") {
+        double sum = 0;
+        for (int i = 1; i <= 2 * n; i++)
+            cdf.push_back(sum += pow(i, -0.99));
+        for (double & c : cdf) c /= sum;
+    }
+    uniform_real_distribution<double> unit(0, 1);
+    if (kind == "sliding window") {
+        w.fill.assign(perm.begin(), perm.end());
+        w.fill.erase(remove_if(w.fill.begin(), w.fill.end(), [&](int k) { return k >= n; }),
+                     w.fill.end());
+    } else w.fill.assign(perm.begin(), perm.begin() + n);
+    int t = 0;
+    bool next_insert = true;
+    for (int i = 0; i < m; i++) {
+        op o;
+        o.type = (unit(gen) < reads ? READ : (gen() & 1) ? INSERT : ERASE);
+        if (kind == "sequential")
+            o.key = i % (2 * n);
+        else if (kind == "uniform")
+            o.key = gen() % (2 * n);
+        else if (kind == "zipfian")
+            o.key = perm[lower_bound(cdf.begin(), cdf.end(), unit(gen)) - cdf.begin()];
+        else if (o.type == READ)
+            o.key = t + gen() % n;
+        else {
+            o.type = (next_insert ? INSERT : ERASE);
+            o.key = (next_insert ? t + n : t++);
+            next_insert = !next_insert;
+        }
+        w.ops.push_back(o);
+    }
+    return w;
+}
+
+size_t heap_in_use()
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+template <typename M>
+M * build(const workload & w, size_t * bytes)
+{
+    size_t before = heap_in_use();
+    M * t = new M;
+    for (int k : w.fill) t->insert(k, k);
+    if (bytes != NULL) *bytes = heap_in_use() - before;
+    return t;
+}
+
+template <typename M>
+int apply(M * t, const op & o)
+{
+    if (o.type == READ) return t->find(o.key);
+    if (o.type == INSERT) t->insert(o.key, o.key);
+    else t->erase(o.key);
+    return 0;
+}
+
+// One pass for the throughput and the rotations, and another, on a fresh
+// copy of the map, that times each operation alone for the percentiles
+// (which therefore include the cost of reading the clock). The number of
+// successful reads is printed last so that they are not optimized away.
+template <typename M>
+void run(const char * name, const workload & w)
+{
+    M * t = build<M>(w, NULL);
+    int m = w.ops.size(), found = 0;
+    long long rot = times_of_rotation;
+    time_point<steady_clock> start = steady_clock::now();
+    for (int i = 0; i < m; i++) found += apply(t, w.ops[i]);
+    double ms = duration<double, milli>(steady_clock::now() - start).count();
+    rot = times_of_rotation - rot;
+    delete t;
+    t = build<M>(w, NULL);
+    vector<float> lat(m);
+    for (int i = 0; i < m; i++) {
+        time_point<steady_clock> s = steady_clock::now();
+        found += apply(t, w.ops[i]);
+        lat[i] = duration<float, nano>(steady_clock::now() - s).count();
+    }
+    delete t;
+    nth_element(lat.begin(), lat.begin() + m / 2, lat.end());
+    float p50 = lat[m / 2];
+    nth_element(lat.begin(), lat.begin() + m * 99 / 100, lat.end());
+    float p99 = lat[m * 99 / 100];
+    char rots[16] = "    n/a";
+    if (M::COUNTED) sprintf(rots, "%7.3f", (double) rot / m);
+    printf("  %-22s %8.2f Mops/s %8.0f ns p50 %8.0f ns p99 %s rot/op  (%d)\n",
+           name, m / ms / 1e3, p50, p99, rots, found);
+}
+
+template <typename M>
+void footprint(const char * name, const workload & w)
+{
+    size_t bytes;
+    M * t = build<M>(w, &bytes);
+    printf("  %-22s %8.1f bytes/key\n", name, (double) bytes / w.fill.size());
+    delete t;
+}
+
+// Calls f.call<M>(name) for every map M.
+template <typename F>
+void for_each_map(F f, bool balanced_only, bool with_treap)
+{
+    if (!balanced_only)
+        f.template call<scl_map<search_tree<int, int> > >("search_tree");
+    f.template call<scl_map<splay_tree<int, int> > >("splay_tree");
+    f.template call<scl_map<treap<int, int> > >("treap");
+    f.template call<scl_map<avl_tree<int, int> > >("avl_tree");
+    f.template call<scl_map<rb_tree<int, int> > >("rb_tree");
+    f.template call<scl_map<b_tree<int, int>, 0> >("b_tree");
+    f.template call<contest_avl>("tree.h avl_tree");
+    if (with_treap)
+        f.template call<contest_treap>("tree.h TREAP::treap");
+    f.template call<std_map>("std::map");
+    f.template call<pbds_map>("pbds rb_tree");
+}
+
+struct run_all {
+    const workload * w;
+    template <typename M>
+    void call(const char * name) { run<M>(name, *w); }
+};
+struct footprint_all {
+    const workload * w;
+    template <typename M>
+    void call(const char * name) { footprint<M>(name, *w); }
+};
+
+int main(int argc, char ** argv)
+{
+    int n = (argc > 1 ? atoi(argv[1]) : 1 << 15);
+    int m = (argc > 2 ? atoi(argv[2]) : 1 << 18);
+    bool with_treap = n < contest::N / 2;
+    printf("%d keys, %d operations per workload%s\n\n", n, m,
+           with_treap ? "" : " (tree.h TREAP::treap needs keys < N / 2, skipped)");
+    const char * kinds[] = { "sequential", "uniform", "zipfian" };
+    double ratios[] = { 0.0, 0.5, 0.95 };
+    vector<workload> ws;
+    for (const char * k : kinds)
+        for (double r : ratios)
+            ws.push_back(make_workload(k, r, n, m));
+    ws.push_back(make_workload("sliding window", 0.5, n, m));
+    printf("memory after inserting %d random keys\n", n);
+    footprint_all fp = { &ws[3] };
+    for_each_map(fp, false, with_treap);
+    printf("\n");
+    for (const workload & w : ws) {
+        bool sliding = w.name.find("sliding") == 0;
+        printf("%s%s\n", w.name.c_str(), sliding ? " (search_tree skipped: keys arrive in order)" : "");
+        run_all ra = { &w };
+        for_each_map(ra, sliding, with_treap);
+        printf("\n");
+    }
+    return 0;
+}
@@ -2,24 +2,43 @@
 #define _TOOL_H
 
 #include <cstdlib>
+#include <atomic>
 
 using namespace std;
 
-int times = 0;
-int times_of_new = 0;
-int times_of_delete = 0;
+// Relaxed atomics: nodes may be allocated on one thread and freed on
+// another (treap::fork, persistent_avl_tree snapshots).
+atomic<int> times(0);
+atomic<int> times_of_new(0);
+atomic<int> times_of_delete(0);
+
+// Rotations done by the trees of search_tree.h and tree.h, counted only
+// when TREE_STATS is defined.
+long long times_of_rotation = 0;
+#ifdef TREE_STATS
+#define COUNT_ROTATIONS(k) (times_of_rotation += (k))
+#else
+#define COUNT_ROTATIONS(k) ((void) 0)
+#endif
 
 void * operator new(size_t n)
 {
-    times++;
-    times_of_new++;
+    times.fetch_add(1, memory_order_relaxed);
+    times_of_new.fetch_add(1, memory_order_relaxed);
     return malloc(n);
 }
 
-void operator delete(void * p)
+void operator delete(void * p) noexcept
+{
+    times.fetch_sub(1, memory_order_relaxed);
+    times_of_delete.fetch_add(1, memory_order_relaxed);
+    free(p);
+}
+
+void operator delete(void * p, size_t) noexcept
 {
-    times--;
-    times_of_delete++;
+    times.fetch_sub(1, memory_order_relaxed);
+    times_of_delete.fetch_add(1, memory_order_relaxed);
     free(p);
 }
 
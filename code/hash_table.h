@@ -5,27 +5,169 @@
 #include <cstring>
 #include <ctime>
 #include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+#include <utility>
+#include <new>
+#include <vector>
+#include <type_traits>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HT_MMAP
+#endif
 using namespace std;
 
+/**
+ * Instrumentation
+ * Define HASH_TABLE_STATS before including this file to make dictionary
+ * and skip_list collect statistics, returned by their stats() methods.
+ * Without it, HT_STAT(...) expands to nothing and the hot paths are the
+ * same as before.
+ * probes[c]: searches that compared c nodes (the last slot also counts
+ * longer searches); chain_length[l]: buckets holding l nodes; levels[h]:
+ * skip_list keys with a tower of height h.
+ * Searches are counted with relaxed atomic adds, since const lookups may
+ * run side by side (concurrent_dictionary reads a shard under a shared
+ * lock). stats() and reset_stats() must not run concurrently with them.
+ */
+#ifdef HASH_TABLE_STATS
+#define HT_STAT(...) __VA_ARGS__
+struct hash_table_stats {
+    enum { MAX_PROBES = 32 };
+    vector<long long> probes;
+    vector<long long> chain_length;
+    vector<long long> levels;
+    long long searches;
+    long long comparisons;
+    long long rehashes;
+    double rehash_time;
+    long long free_list_reuses;
+    hash_table_stats()
+    : probes(MAX_PROBES + 1), searches(0), comparisons(0),
+      rehashes(0), rehash_time(0), free_list_reuses(0) { }
+    void search(int c) {
+        __atomic_fetch_add(&probes[min(c, (int) MAX_PROBES)], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&searches, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&comparisons, c, __ATOMIC_RELAXED);
+    }
+    double comparisons_per_search() const
+    { return searches == 0 ? 0 : double(comparisons) / searches; }
+    void print(FILE * f = stderr) const {
+        fprintf(f, "searches: %lld, comparisons per search: %.3f\n",
+                searches, comparisons_per_search());
+        fprintf(f, "rehashes: %lld (%.3f ms), free list reuses: %lld\n",
+                rehashes, rehash_time, free_list_reuses);
+        print(f, "probes", probes);
+        print(f, "chain length", chain_length);
+        print(f, "levels", levels);
+    }
+    static void print(FILE * f, const char * name, const vector<long long> & h) {
+        if (h.empty()) return;
+        fprintf(f, "%s:", name);
+        for (int i = 0; i < (int) h.size(); i++)
+            if (h[i] != 0) fprintf(f, " [%d] %lld", i, h[i]);
+        fprintf(f, "\n");
+    }
+};
+#else
+#define HT_STAT(...)
+#endif
+
+// The 64-bit finalizer of MurmurHash3: every input bit affects every
+// output bit. Spreads the ints returned by H before they pick buckets,
+// blocks, fingerprints or registers.
+static inline unsigned long long mix64(unsigned long long x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
 template <typename K, typename V>
 class skip_list;
 template <typename K, typename V>
+class compact_skip_list;
+template <typename K, typename V>
 class entry {
 private:
     K _key;
     V _value;
 public:
-    entry(const K & k = K(), const V & v = V())
+    entry() : _key(), _value() { }
+    entry(const K & k, const V & v = V())
          : _key(k), _value(v) { }
     const K & key() const { return _key; }
     const V & value() const { return _value; }
     void set_value(const V & v) { _value = v; }
     friend class skip_list<K, V>;
-    template <typename K1, typename V1, typename H>
+    friend class compact_skip_list<K, V>;
+    template <typename K1, typename V1, typename H, typename P>
     friend class dictionary;
+    template <typename K1, typename V1, typename H, typename P>
+    friend class incremental_dictionary;
+    template <typename K1, typename V1, typename H>
+    friend class flat_dictionary;
+    template <typename K1, typename V1, typename H, typename F, typename P>
+    friend class filtered_dictionary;
+    template <typename K1, typename V1, typename H, typename E>
+    friend class bounded_cache;
 };
 
-template <typename K, typename V, typename H>
+/**
+ * Growth Policies for dictionary
+ * capacity(n) gives the table size to grow to, reset(c) is called whenever
+ * the table is rebuilt with c buckets, and index(h) maps a hash code to its
+ * bucket, replacing h % capacity.
+ * prime_growth: sizes come from a table of primes (roughly doubling), and
+ * the modulo is computed with a precomputed 64-bit reciprocal (fastmod).
+ * power2_growth: sizes are powers of two, and the bucket is chosen by
+ * Fibonacci hashing: the top bits of h * 2^64 / phi.
+ */
+struct prime_growth {
+    unsigned cap;
+    unsigned long long m;
+    int capacity(int n) const {
+        static const int primes[] = {
+            3, 7, 13, 29, 53, 97, 193, 389, 769, 1543, 3079, 6151,
+            12289, 24593, 49157, 98317, 196613, 393241, 786433,
+            1572869, 3145739, 6291469, 12582917, 25165843, 50331653,
+            100663319, 201326611, 402653189, 805306457, 1610612741
+        };
+        int i = 0;
+        while (i < 29 && primes[i] < n) i++;
+        return primes[i];
+    }
+    void reset(int c) { cap = c; m = ~0ULL / c + 1; }
+    int index(int h) const {
+        unsigned long long low = m * (unsigned) h;
+        return ((unsigned __int128) low * cap) >> 64;
+    }
+};
+struct power2_growth {
+    int shift;
+    int capacity(int n) const
+    { return n <= 4 ? 4 : 1 << (32 - __builtin_clz(n - 1)); }
+    void reset(int c) { shift = 64 - __builtin_ctz(c); }
+    int index(int h) const
+    { return ((unsigned) h * 0x9E3779B97F4A7C15ULL) >> shift; }
+};
+
+template <typename K, typename V, typename H, typename P = prime_growth>
 class dictionary {
 private:
     struct node {
@@ -66,98 +208,163 @@ private:
     int n;
     int free_list;
     int last;
-    int upper;
     int * bucket;
     node * data;
+    void * mapping;
+    size_t mapping_size;
     H hash;
+    P policy;
 public:
     dictionary(int cap = 3)
-              : capacity(0), n(0), free_list(0), last(-1), upper(0) {
-        capacity = prime(cap);
+              : capacity(0), n(0), free_list(0), last(-1), mapping(NULL), mapping_size(0) {
+        capacity = policy.capacity(cap);
+        policy.reset(capacity);
         bucket = new int [capacity];
         memset(bucket, -1, sizeof(int) * capacity);
-        data = new node [capacity];
+        data = new node [capacity + 1];
         data[last + 1].is_end = true;
     }
-    dictionary(const dictionary<K, V, H> & dict)
-    : capacity(dict.capacity), n(dict.n), free_list(dict.free_list), last(dict.last), upper(dict.upper) {
-        bucket = new int [capacity];
-        memcpy(bucket, dict.bucket, sizeof(int) * capacity);
-        data = new node [capacity];
-        memcpy(data, dict.data, sizeof(node) * capacity);
-    }
-    ~dictionary() { delete [] bucket; delete [] data; }
-    dictionary<K, V, H> & operator=(const dictionary<K, V, H> & dict) {
-        delete [] bucket;
-        delete [] data;
-        capacity = dict.capacity;
-        n = dict.n;
-        free_list = dict.free_list;
-        last = dict.last;
-        upper = dict.upper;
+    dictionary(const dictionary<K, V, H, P> & dict)
+    : capacity(dict.capacity), n(dict.n), free_list(dict.free_list), last(dict.last),
+      mapping(NULL), mapping_size(0), policy(dict.policy) {
         bucket = new int [capacity];
         memcpy(bucket, dict.bucket, sizeof(int) * capacity);
-        data = new node [capacity];
-        memcpy(data, dict.data, sizeof(node) * capacity);
-        return *this;
+        data = new node [capacity + 1];
+        for (int i = 0; i <= capacity; i++)
+            data[i] = dict.data[i];
     }
-    V & operator[](const K & k) {
-        ensure_capacity(n + 1);
+    dictionary(dictionary<K, V, H, P> && dict) : dictionary()
+    { swap_with(dict); }
+    ~dictionary() { release(); }
+    dictionary<K, V, H, P> & operator=(dictionary<K, V, H, P> dict)
+    { swap_with(dict); return *this; }
+    V & operator[](const K & k)
+    { return try_emplace(k).first->_value; }
+    V & operator[](K && k)
+    { return try_emplace(move(k)).first->_value; }
+    iterator find(const K & k) const {
         int h = hash(k);
-        int i = h % capacity;
+        int i = policy.index(h);
         if (bucket[i] == -1) {
-            bucket[i] = inserter(k, V(), h);
-            return data[bucket[i]].ent._value;
+            HT_STAT(st.search(0);)
+            return end();
         }
         i = bucket[i];
         int p;
-        if (finder(k, h, i, p))
-            return data[i].ent._value;
-        int j = inserter(k, V(), h);
-        data[i].next = j;
-        return data[j].ent._value;
-    }
-    iterator find(const K & k) const {
-        int h = hash(k);
-        int i = h % capacity;
-        if (bucket[i] == -1) return end();
-        i = bucket[i];
-        int p;
         if (finder(k, h, i, p))
             return iterator(data + i);
         return end();
     }
     iterator insert(const K & k, const V & v) {
+        ensure_capacity(n + 1);
+        pair<iterator, bool> r = emplacer(hash(k), k, v);
+        return r.second ? r.first : end();
+    }
+    iterator insert(K && k, V && v) {
         ensure_capacity(n + 1);
         int h = hash(k);
-        int i = h % capacity;
-        if (bucket[i] != -1) {
-            i = bucket[i];
-            int p;
-            if (finder(k, h, i, p))
-                return end();
-            data[i].next = free_list;
-        } else bucket[i] = free_list;
-        int j = inserter(k, v, h);
-        return iterator(data + j);
+        pair<iterator, bool> r = emplacer(h, move(k), move(v));
+        return r.second ? r.first : end();
+    }
+    /**
+     * Like insert, but the value is constructed from args, and only if k
+     * is not in the dictionary yet.
+     */
+    template <typename... Args>
+    iterator emplace(const K & k, Args &&... args) {
+        pair<iterator, bool> r = try_emplace(k, forward<Args>(args)...);
+        return r.second ? r.first : end();
+    }
+    /**
+     * Returns the entry of k and whether it was inserted. If k is already
+     * present, neither k nor args are touched.
+     */
+    template <typename... Args>
+    pair<iterator, bool> try_emplace(const K & k, Args &&... args) {
+        ensure_capacity(n + 1);
+        return emplacer(hash(k), k, forward<Args>(args)...);
+    }
+    template <typename... Args>
+    pair<iterator, bool> try_emplace(K && k, Args &&... args) {
+        ensure_capacity(n + 1);
+        int h = hash(k);
+        return emplacer(h, move(k), forward<Args>(args)...);
+    }
+    /**
+     * Batched lookup: out[i] = find(keys[i]).
+     * Keys are handled in blocks: hash the whole block and prefetch the
+     * buckets, then prefetch the chain heads, and only then walk the
+     * chains, so the cache misses of different keys overlap.
+     */
+    void find_batch(const K * keys, int m, iterator * out) const {
+        int h[BATCH], b[BATCH];
+        for (int s = 0; s < m; s += BATCH) {
+            int e = min(m - s, (int) BATCH);
+            for (int j = 0; j < e; j++) {
+                h[j] = hash(keys[s + j]);
+                b[j] = policy.index(h[j]);
+                __builtin_prefetch(bucket + b[j]);
+            }
+            for (int j = 0; j < e; j++) {
+                b[j] = bucket[b[j]];
+                if (b[j] != -1) __builtin_prefetch(data + b[j]);
+            }
+            for (int j = 0; j < e; j++) {
+                int i = b[j], p;
+                HT_STAT(if (i == -1) st.search(0);)
+                if (i != -1 && finder(keys[s + j], h[j], i, p))
+                    out[s + j] = iterator(data + i);
+                else out[s + j] = end();
+            }
+        }
+    }
+    /**
+     * Batched insert: insert(keys[i], values[i]) for every i, with the same
+     * prefetching as find_batch. The table only grows to fit the block at
+     * hand, so a batch of keys that are mostly present already leaves it
+     * about as big as single inserts would. If inserted is not NULL,
+     * inserted[i] tells whether keys[i] was new.
+     */
+    void insert_batch(const K * keys, const V * values, int m, bool * inserted = NULL) {
+        int h[BATCH], b[BATCH];
+        for (int s = 0; s < m; s += BATCH) {
+            int e = min(m - s, (int) BATCH);
+            ensure_capacity(n + e);
+            for (int j = 0; j < e; j++) {
+                h[j] = hash(keys[s + j]);
+                b[j] = policy.index(h[j]);
+                __builtin_prefetch(bucket + b[j]);
+            }
+            for (int j = 0; j < e; j++)
+                if (bucket[b[j]] != -1)
+                    __builtin_prefetch(data + bucket[b[j]]);
+            for (int j = 0; j < e; j++) {
+                bool ok = emplacer(h[j], keys[s + j], values[s + j]).second;
+                if (inserted != NULL) inserted[s + j] = ok;
+            }
+        }
     }
     void erase(const iterator & u)
     { erase(u->key()); }
     void erase(const K & k) {
         int h = hash(k);
-        int i = h % capacity;
-        if (bucket[i] == -1) return;
+        int i = policy.index(h);
+        if (bucket[i] == -1) {
+            HT_STAT(st.search(0);)
+            return;
+        }
         int j = bucket[i], p = -1;
         if (finder(k, h, j, p)) {
             if (p == -1)
                 bucket[i] = data[j].next;
             else data[p].next = data[j].next;
             data[j].hash_code = -1;
+            data[j].ent = entry<K, V>();
             data[j].next = free_list;
             free_list = j;
             if (j == last) {
                 data[last + 1].is_end = false;
-                while (data[last].hash_code == -1)
+                while (last >= 0 && data[last].hash_code == -1)
                     last--;
                 data[last + 1].is_end = true;
             }
@@ -165,9 +372,12 @@ public:
         }
     }
     void clear() {
+        if (mapping != NULL) {
+            release();
+            bucket = new int [capacity];
+        } else delete [] data;
         memset(bucket, -1, sizeof(int) * capacity);
-        delete [] data;
-        data = new node [capacity];
+        data = new node [capacity + 1];
         n = 0;
         free_list = 0;
         last = -1;
@@ -184,24 +394,137 @@ public:
     { return n; }
     bool empty() const
     { return n == 0; }
+#ifdef HT_MMAP
+    /**
+     * Snapshots, for trivially copyable K and V (and a hash functor that is
+     * the same in every process).
+     * save writes a header followed by the bucket and node arrays as they
+     * are in memory. load maps such a file copy-on-write instead of reading
+     * it: find is served straight from the mapping, pages are read in on
+     * first touch, and the file itself is never modified. Inserts and
+     * erases work on private copies of the touched pages; when the table
+     * grows or is cleared it moves to the heap and the mapping is dropped.
+     * load returns false and leaves the dictionary unchanged if the file
+     * does not match K, V and P.
+     */
+    bool save(const char * path) const {
+        static_assert(is_trivially_copyable<K>::value && is_trivially_copyable<V>::value,
+                      "dictionary::save needs trivially copyable K and V");
+        FILE * f = fopen(path, "wb");
+        if (f == NULL) return false;
+        int header[SNAPSHOT_HEADER / sizeof(int)] = { SNAPSHOT_MAGIC, SNAPSHOT_VERSION,
+            (int) sizeof(K), (int) sizeof(V), (int) sizeof(node), capacity, n, free_list, last };
+        size_t pad = snapshot_offset(capacity) - SNAPSHOT_HEADER - sizeof(int) * capacity;
+        char zero[SNAPSHOT_HEADER] = { };
+        bool ok = fwrite(header, sizeof(header), 1, f) == 1
+               && fwrite(bucket, sizeof(int), capacity, f) == (size_t) capacity
+               && fwrite(zero, 1, pad, f) == pad
+               && fwrite(data, sizeof(node), capacity + 1, f) == (size_t) capacity + 1;
+        return fclose(f) == 0 && ok;
+    }
+    bool load(const char * path) {
+        static_assert(is_trivially_copyable<K>::value && is_trivially_copyable<V>::value,
+                      "dictionary::load needs trivially copyable K and V");
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat s;
+        void * p = MAP_FAILED;
+        if (fstat(fd, &s) == 0 && (size_t) s.st_size >= (size_t) SNAPSHOT_HEADER)
+            p = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) return false;
+        const int * header = (const int *) p;
+        int c = header[5];
+        P pol;
+        bool ok = header[0] == SNAPSHOT_MAGIC && header[1] == SNAPSHOT_VERSION
+               && header[2] == (int) sizeof(K) && header[3] == (int) sizeof(V)
+               && header[4] == (int) sizeof(node) && c > 0 && pol.capacity(c) == c
+               && 0 <= header[6] && header[6] <= c && 0 <= header[7] && header[7] <= c
+               && -1 <= header[8] && header[8] < c
+               && (size_t) s.st_size == snapshot_offset(c) + sizeof(node) * (c + 1);
+        if (!ok) {
+            munmap(p, s.st_size);
+            return false;
+        }
+        release();
+        mapping = p;
+        mapping_size = s.st_size;
+        capacity = c;
+        n = header[6];
+        free_list = header[7];
+        last = header[8];
+        bucket = (int *) ((char *) p + SNAPSHOT_HEADER);
+        data = (node *) ((char *) p + snapshot_offset(c));
+        policy = pol;
+        policy.reset(capacity);
+        return true;
+    }
+#endif
 private:
+    enum { BATCH = 16 };
+    enum { SNAPSHOT_MAGIC = 0x44544353, SNAPSHOT_VERSION = 1, SNAPSHOT_HEADER = 64 };
+    static size_t snapshot_offset(int c)
+    { return (SNAPSHOT_HEADER + sizeof(int) * c + 63) & ~(size_t) 63; }
+    void release() {
+#ifdef HT_MMAP
+        if (mapping != NULL) {
+            munmap(mapping, mapping_size);
+            mapping = NULL;
+            return;
+        }
+#endif
+        delete [] bucket;
+        delete [] data;
+    }
+    void swap_with(dictionary<K, V, H, P> & dict) {
+        swap(capacity, dict.capacity);
+        swap(n, dict.n);
+        swap(free_list, dict.free_list);
+        swap(last, dict.last);
+        swap(bucket, dict.bucket);
+        swap(data, dict.data);
+        swap(mapping, dict.mapping);
+        swap(mapping_size, dict.mapping_size);
+        swap(policy, dict.policy);
+    }
+    template <typename KK, typename... Args>
+    pair<iterator, bool> emplacer(int h, KK && k, Args &&... args) {
+        int i = policy.index(h);
+        if (bucket[i] != -1) {
+            i = bucket[i];
+            int p;
+            if (finder(k, h, i, p))
+                return make_pair(iterator(data + i), false);
+            data[i].next = free_list;
+        } else {
+            HT_STAT(st.search(0);)
+            bucket[i] = free_list;
+        }
+        int j = inserter(h, forward<KK>(k), forward<Args>(args)...);
+        return make_pair(iterator(data + j), true);
+    }
     bool finder(const K & k, const int & h, int & i, int & j) const {
+        HT_STAT(int c = 1;)
         while ((data[i].hash_code != h || (data[i].hash_code == h && data[i].ent._key != k))
                && data[i].next != -1) {
             j = i;
             i = data[i].next;
+            HT_STAT(c++;)
         }
+        HT_STAT(st.search(c);)
         return data[i].hash_code == h && data[i].ent._key == k;
     }
-    int inserter(const K & k, const V & v, const int & h) {
+    template <typename KK, typename... Args>
+    int inserter(int h, KK && k, Args &&... args) {
         int i = free_list;
+        HT_STAT(if (i <= last) st.free_list_reuses++;)
         if (i > last) {
             data[last + 1].is_end = false;
             last = i;
             data[last + 1].is_end = true;
         }
-        data[i].ent._key = k;
-        data[i].ent._value = v;
+        data[i].ent._key = forward<KK>(k);
+        data[i].ent._value = V(forward<Args>(args)...);
         data[i].hash_code = h;
         if (data[free_list].next != -1) {
             free_list = data[free_list].next;
@@ -211,68 +534,190 @@ private:
         return i;
     }
 private:
-    bool is_prime(int num) const {
-        if (num < 2) return false;
-        for (int i = 2; i * i <= num; i++)
-            if (num % i == 0) return false;
-        return true;
-    }
-    int prime(int new_capacity) {
-        if (is_prime(upper) && new_capacity <= upper)
-            return upper;
-        while (!is_prime(new_capacity))
-            new_capacity++;
-        return upper = new_capacity;
-    }
     void ensure_capacity(int new_capacity) {
-        new_capacity = prime(new_capacity);
         if (new_capacity <= capacity) return;
+        HT_STAT(chrono::steady_clock::time_point start = chrono::steady_clock::now();)
+        new_capacity = policy.capacity(new_capacity);
+        policy.reset(new_capacity);
         int * new_bucket = new int [new_capacity];
         memset(new_bucket, -1, sizeof(int) * new_capacity);
-        node * new_data = new node [new_capacity];
-        memcpy(new_data, data, sizeof(node) * n);
-        for (int i = 0; i < n; i++) {
+        node * new_data = new node [new_capacity + 1];
+        for (int i = 0; i <= last + 1; i++)
+            new_data[i] = move(data[i]);
+        for (int i = 0; i <= last; i++) {
             int h = new_data[i].hash_code;
             if (h != -1) {
-                int j = h % new_capacity;
+                int j = policy.index(h);
                 new_data[i].next = new_bucket[j];
                 new_bucket[j] = i;
             }
         }
-        delete [] bucket;
+        release();
         bucket = new_bucket;
-        delete [] data;
         data = new_data;
         capacity = new_capacity;
+        HT_STAT(st.rehashes++;)
+        HT_STAT(st.rehash_time += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();)
+    }
+#ifdef HASH_TABLE_STATS
+public:
+    hash_table_stats stats() const {
+        hash_table_stats s = st;
+        for (int i = 0; i < capacity; i++) {
+            int l = 0;
+            for (int j = bucket[i]; j != -1; j = data[j].next)
+                l++;
+            if (l >= (int) s.chain_length.size())
+                s.chain_length.resize(l + 1);
+            s.chain_length[l]++;
+        }
+        return s;
     }
+    void reset_stats() { st = hash_table_stats(); }
+private:
+    mutable hash_table_stats st;
+#endif
 };
 
-template <typename K, typename V>
-class skip_list {
+/**
+ * Concurrent Dictionary
+ * S independent dictionaries (shards), each behind its own reader-writer
+ * lock. A key goes to the shard picked by the top bits of its mixed hash
+ * (a different multiplier from power2_growth, so the shard and the bucket
+ * inside it use independent bits). Lookups take a shared lock on one shard
+ * only, so readers never wait for a writer or a rehash in another shard.
+ * Since entries may move when a shard grows, values are copied out instead
+ * of returned by reference; update(k, f) runs f(value) under the lock.
+ */
+template <typename K, typename V, typename H, typename P = prime_growth, int S = 64>
+class concurrent_dictionary {
+private:
+    struct alignas(64) shard {
+        mutable shared_timed_mutex lock;
+        dictionary<K, V, H, P> dict;
+    };
+    typedef shared_lock<shared_timed_mutex> read_lock;
+    typedef lock_guard<shared_timed_mutex> write_lock;
+public:
+    concurrent_dictionary() { }
+    bool find(const K & k, V & v) const {
+        const shard & s = pick(k);
+        read_lock guard(s.lock);
+        typename dictionary<K, V, H, P>::iterator u = s.dict.find(k);
+        if (u == s.dict.end()) return false;
+        v = u->value();
+        return true;
+    }
+    bool contains(const K & k) const {
+        const shard & s = pick(k);
+        read_lock guard(s.lock);
+        return s.dict.find(k) != s.dict.end();
+    }
+    bool insert(const K & k, const V & v) {
+        shard & s = pick(k);
+        write_lock guard(s.lock);
+        typename dictionary<K, V, H, P>::iterator u = s.dict.insert(k, v);
+        return u != s.dict.end();
+    }
+    void assign(const K & k, const V & v) {
+        shard & s = pick(k);
+        write_lock guard(s.lock);
+        s.dict[k] = v;
+    }
+    template <typename F>
+    void update(const K & k, F f) {
+        shard & s = pick(k);
+        write_lock guard(s.lock);
+        f(s.dict[k]);
+    }
+    bool erase(const K & k) {
+        shard & s = pick(k);
+        write_lock guard(s.lock);
+        int n = s.dict.size();
+        s.dict.erase(k);
+        return s.dict.size() != n;
+    }
+    void clear() {
+        for (int i = 0; i < S; i++) {
+            write_lock guard(shards[i].lock);
+            shards[i].dict.clear();
+        }
+    }
+    template <typename F>
+    void for_each(F f) const {
+        for (int i = 0; i < S; i++) {
+            read_lock guard(shards[i].lock);
+            for (typename dictionary<K, V, H, P>::iterator u = shards[i].dict.begin();
+                 u != shards[i].dict.end(); ++u)
+                f(u->key(), u->value());
+        }
+    }
+    int size() const {
+        int n = 0;
+        for (int i = 0; i < S; i++) {
+            read_lock guard(shards[i].lock);
+            n += shards[i].dict.size();
+        }
+        return n;
+    }
+    bool empty() const { return size() == 0; }
+private:
+    static_assert((S & (S - 1)) == 0, "S must be a power of two");
+    int index(const K & k) const {
+        if (S == 1) return 0;
+        unsigned long long x = (unsigned) hash(k) * 0xff51afd7ed558ccdULL;
+        return x >> (64 - __builtin_ctz(S));
+    }
+    shard & pick(const K & k) { return shards[index(k)]; }
+    const shard & pick(const K & k) const { return shards[index(k)]; }
 private:
+    shard shards[S];
+    H hash;
+};
+
+/**
+ * Incremental Dictionary
+ * Same chaining scheme as dictionary, but the rehash is spread over later
+ * operations instead of being done in one pass. When the table fills up, a
+ * second bucket array is allocated next to the old one, and every insert,
+ * erase or find moves at most step buckets (set_rehash_step) from the old
+ * array to the new one. Lookups search both arrays until the move is done.
+ * Nodes live in fixed-size blocks that never move, so growing the node
+ * storage only allocates one more block. Bucket arrays come from calloc
+ * with heads stored as index + 1, so a new array costs no O(n) memset.
+ * max_pause() is the longest time (in microseconds) a single operation has
+ * spent on rehashing work.
+ */
+template <typename K, typename V, typename H, typename P = prime_growth>
+class incremental_dictionary {
+private:
+    enum { BLOCK_BITS = 10, BLOCK = 1 << BLOCK_BITS };
     struct node {
+        int hash_code;
         entry<K, V> ent;
-        node * before;
-        node * after;
-        node * above;
-        node * below;
-        int height;
-        node() : ent(), before(NULL), after(NULL), above(NULL), below(NULL), height(0) { }
+        int next;
+        node() : hash_code(-1), ent(), next(-1) { }
     };
 public:
     class iterator {
+    private:
+        const incremental_dictionary<K, V, H, P> * d;
+        int i;
     public:
-        iterator(node * _p = NULL) : p(_p) { }
-        entry<K, V> & operator*() { return p->ent; }
-        entry<K, V> & operator*() const { return p->ent; }
-        entry<K, V> * operator->() { return &p->ent; }
-        entry<K, V> * operator->() const { return &p->ent; }
-        bool operator==(const iterator & v) const
-        { return p == v.p; }
-        bool operator!=(const iterator & v) const
-        { return p != v.p; }
+        iterator(const incremental_dictionary<K, V, H, P> * _d = NULL, int _i = 0)
+                : d(_d), i(_i) { }
+        entry<K, V> * operator->() { return &d->at(i).ent; }
+        entry<K, V> * operator->() const { return &d->at(i).ent; }
+        entry<K, V> & operator*() { return d->at(i).ent; }
+        entry<K, V> & operator*() const { return d->at(i).ent; }
+        bool operator==(const iterator & u) const
+        { return u.i == i; }
+        bool operator!=(const iterator & u) const
+        { return u.i != i; }
         iterator & operator++() {
-            p = p->after;
+            do {
+                ++i;
+            } while (i < d->used && d->at(i).hash_code == -1);
             return *this;
         }
         iterator operator++(int) {
@@ -280,133 +725,1630 @@ public:
             ++*this;
             return tmp;
         }
-        friend class skip_list<K, V>;
-    private:
-        node * p;
     };
+private:
+    int n;
+    int used;
+    int free_list;
+    int capacity[2];
+    int * bucket[2];
+    P policy[2];
+    int rehash_idx;
+    int step;
+    double pause;
+    vector<node *> blocks;
+    H hash;
 public:
-    skip_list() : n(0) { create(); }
-    ~skip_list() { destroy(); }
+    incremental_dictionary(int cap = 3)
+    : n(0), used(0), free_list(-1), rehash_idx(-1), step(1), pause(0) {
+        capacity[0] = policy[0].capacity(cap);
+        policy[0].reset(capacity[0]);
+        bucket[0] = (int *) calloc(capacity[0], sizeof(int));
+        capacity[1] = 0;
+        bucket[1] = NULL;
+    }
+    incremental_dictionary(const incremental_dictionary<K, V, H, P> & dict)
+    : n(dict.n), used(dict.used), free_list(dict.free_list), rehash_idx(dict.rehash_idx),
+      step(dict.step), pause(dict.pause), blocks(dict.blocks.size()) {
+        for (int t = 0; t < 2; t++) {
+            capacity[t] = dict.capacity[t];
+            policy[t] = dict.policy[t];
+            bucket[t] = NULL;
+            if (dict.bucket[t] != NULL) {
+                bucket[t] = (int *) malloc(sizeof(int) * capacity[t]);
+                memcpy(bucket[t], dict.bucket[t], sizeof(int) * capacity[t]);
+            }
+        }
+        for (int i = 0; i < (int) blocks.size(); i++) {
+            blocks[i] = new node [BLOCK];
+            for (int j = 0; j < BLOCK; j++)
+                blocks[i][j] = dict.blocks[i][j];
+        }
+    }
+    ~incremental_dictionary() { destroy(); }
+    incremental_dictionary<K, V, H, P> & operator=(const incremental_dictionary<K, V, H, P> & dict) {
+        incremental_dictionary<K, V, H, P> copy = dict;
+        swap(n, copy.n);
+        swap(used, copy.used);
+        swap(free_list, copy.free_list);
+        swap(capacity, copy.capacity);
+        swap(bucket, copy.bucket);
+        swap(policy, copy.policy);
+        swap(rehash_idx, copy.rehash_idx);
+        swap(step, copy.step);
+        swap(pause, copy.pause);
+        swap(blocks, copy.blocks);
+        return *this;
+    }
     V & operator[](const K & k) {
-        iterator u = finder(k);
-        if (u.p == root || u->key() != k)
-            return inserter(u, k, V())->_value;
-        else return u->_value;
+        rehash();
+        int h = hash(k);
+        int i = finder(k, h);
+        if (i == -1) i = inserter(k, V(), h);
+        return at(i).ent._value;
     }
     iterator find(const K & k) {
-        iterator u = finder(k);
-        if (u.p == root || u->key() != k) return end();
-        return u;
+        rehash();
+        int i = finder(k, hash(k));
+        if (i == -1) return end();
+        return iterator(this, i);
     }
     iterator insert(const K & k, const V & v) {
-        iterator u = finder(k);
-        if (u.p != root && u->key() == k) return end();
-        return inserter(u, k, v);
+        rehash();
+        int h = hash(k);
+        if (finder(k, h) != -1) return end();
+        return iterator(this, inserter(k, v, h));
     }
+    void erase(const iterator & u)
+    { erase(u->key()); }
     void erase(const K & k) {
-        iterator u = finder(k);
-        if (u.p != root && u->key() == k)
-            erase(u);
-    }
-    void erase(const iterator & p) {
-        node * u = p.p;
-        do {
-            node * v = u->above;
-            u->before->after = u->after;
-            u->after->before = u->before;
-            delete u;
-            u = v;
-        } while (u != NULL);
-        n--;
+        rehash();
+        int h = hash(k);
+        for (int t = 0; t < 2 && bucket[t] != NULL; t++) {
+            int * p = &bucket[t][policy[t].index(h)];
+            int i = *p - 1;
+            int prev = -1;
+            while (i != -1 && (at(i).hash_code != h || at(i).ent._key != k)) {
+                prev = i;
+                i = at(i).next;
+            }
+            if (i == -1) continue;
+            if (prev == -1) *p = at(i).next + 1;
+            else at(prev).next = at(i).next;
+            at(i).hash_code = -1;
+            at(i).ent = entry<K, V>();
+            at(i).next = free_list;
+            free_list = i;
+            n--;
+            return;
+        }
     }
     void clear() {
         destroy();
-        create();
-        n = 0;
+        n = used = 0;
+        free_list = rehash_idx = -1;
+        policy[0].reset(capacity[0]);
+        bucket[0] = (int *) calloc(capacity[0], sizeof(int));
+        capacity[1] = 0;
+        bucket[1] = NULL;
     }
-    iterator begin() { return iterator(root->after); }
-    iterator end() { return iterator(null); }
-    int size() const { return n; }
-    bool empty() const { return n == 0; }
+    iterator begin() const {
+        int i = 0;
+        while (i < used && at(i).hash_code == -1)
+            i++;
+        return iterator(this, i);
+    }
+    iterator end() const { return iterator(this, used); }
+    int size() const
+    { return n; }
+    bool empty() const
+    { return n == 0; }
+    bool rehashing() const
+    { return rehash_idx != -1; }
+    int rehash_step() const
+    { return step; }
+    void set_rehash_step(int s)
+    { step = max(s, 1); }
+    double max_pause() const
+    { return pause; }
+    void reset_max_pause()
+    { pause = 0; }
 private:
-    iterator finder(const K & k) {
-        node * v = highest_root;
-        node * u = highest_null;
-        while (v->below != NULL) {
-            v = v->below;
-            u = u->below;
-            while (v->after != u && k >= v->after->ent._key)
-                v = v->after;
+    node & at(int i) const
+    { return blocks[i >> BLOCK_BITS][i & (BLOCK - 1)]; }
+    int finder(const K & k, int h) const {
+        for (int t = 0; t < 2 && bucket[t] != NULL; t++) {
+            int i = bucket[t][policy[t].index(h)] - 1;
+            while (i != -1) {
+                if (at(i).hash_code == h && at(i).ent._key == k)
+                    return i;
+                i = at(i).next;
+            }
         }
-        return iterator(v);
+        return -1;
     }
-    iterator inserter(const iterator & p, const K & k, const V & v) {
-        node * u = p.p;
-        node * t = NULL;
-        node * r = root;
-        node * w = null;
-        iterator ret;
-        int h = 0;
-        do {
-            if (h > height_max(n + 1)) break;
-            h++;
-            node * tt = t;
-            if (h == 1) {
-                t = insert_after(u, k, v);
-                ret = iterator(t);
-            } else t = insert_after(u, k, V());
-            if (tt != NULL) {
-                t->below = tt;
-                tt->above = t;
-            }
-            while (u != r && u->above == NULL)
-                u = u->before;
-            if (u->above == NULL) {
-                node * tr = new node;
-                tr->height = h;
-                tr->below = r;
-                r->above = tr;
-                node * tn = new node;
-                tn->below = w;
-                w->above = tn;
-                tn->height = h;
-                tr->after = tn;
-                tn->before = tr;
-                highest_root = tr;
-                highest_null = tn;
-            }
-            u = u->above;
-            r = r->above;
-            w = w->above;
-        } while (rand() % 2);
+    int inserter(const K & k, const V & v, int h) {
+        if (n + 1 > capacity[0] && !rehashing()) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            capacity[1] = policy[1].capacity(capacity[0] + 1);
+            policy[1].reset(capacity[1]);
+            bucket[1] = (int *) calloc(capacity[1], sizeof(int));
+            rehash_idx = 0;
+            record(start);
+        }
+        int i = free_list;
+        if (i != -1) free_list = at(i).next;
+        else {
+            i = used++;
+            if ((i >> BLOCK_BITS) == (int) blocks.size())
+                blocks.push_back(new node [BLOCK]);
+        }
+        int t = rehashing() ? 1 : 0;
+        int & head = bucket[t][policy[t].index(h)];
+        at(i).hash_code = h;
+        at(i).ent._key = k;
+        at(i).ent._value = v;
+        at(i).next = head - 1;
+        head = i + 1;
         n++;
-        return ret;
+        return i;
     }
-    node * insert_after(node * u, const K & k, const V & v) {
-        node * p = u;
-        node * t = new node;
-        t->ent._key = k;
-        t->ent._value = v;
-        t->before = p;
-        t->after = p->after;
-        t->height = p->height;
-        p->after->before = t;
-        p->after = t;
-        return t;
+    void rehash() {
+        if (!rehashing()) return;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        int moved = 0, empty_visits = step * 10;
+        while (moved < step && rehash_idx < capacity[0]) {
+            int i = bucket[0][rehash_idx] - 1;
+            if (i == -1) {
+                rehash_idx++;
+                if (--empty_visits == 0) break;
+                continue;
+            }
+            while (i != -1) {
+                int next = at(i).next;
+                int & head = bucket[1][policy[1].index(at(i).hash_code)];
+                at(i).next = head - 1;
+                head = i + 1;
+                i = next;
+            }
+            bucket[0][rehash_idx++] = 0;
+            moved++;
+        }
+        if (rehash_idx == capacity[0]) {
+            free(bucket[0]);
+            bucket[0] = bucket[1];
+            capacity[0] = capacity[1];
+            policy[0] = policy[1];
+            bucket[1] = NULL;
+            capacity[1] = 0;
+            rehash_idx = -1;
+        }
+        record(start);
     }
-    void create() {
-        root = new node;
-        null = new node;
-        root->after = null;
-        null->before = root;
-        highest_root = root;
-        highest_null = null;
-        srand(time(NULL));
+    void record(const chrono::steady_clock::time_point & start) {
+        double t = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        if (t > pause) pause = t;
     }
     void destroy() {
-        node * p = root;
-        while (p != NULL) {
-            node * u = p->above;
+        free(bucket[0]);
+        free(bucket[1]);
+        for (int i = 0; i < (int) blocks.size(); i++)
+            delete [] blocks[i];
+        blocks.clear();
+    }
+};
+
+/**
+ * Flat Dictionary (Swiss Table)
+ * Open addressing over groups of 16 slots. Every slot has a control byte:
+ * EMPTY, DELETED, or the low 7 bits of the hash of the key stored there.
+ * A lookup compares the 7 bits against a whole group at once (one SSE2
+ * compare, or a plain loop without SSE2) and only touches the keys whose
+ * control bytes match, so most probes cost one cache line.
+ * Same interface as dictionary<K, V, H>; they can be switched by typedef.
+ */
+template <typename K, typename V, typename H>
+class flat_dictionary {
+private:
+    enum { GROUP = 16 };
+    static const signed char EMPTY = -128;
+    static const signed char DELETED = -2;
+    static const signed char END = -1;
+public:
+    class iterator {
+    private:
+        entry<K, V> * p;
+        const signed char * c;
+    public:
+        iterator(entry<K, V> * _p = NULL, const signed char * _c = NULL)
+                : p(_p), c(_c) { }
+        entry<K, V> * operator->() { return p; }
+        entry<K, V> * operator->() const { return p; }
+        entry<K, V> & operator*() { return *p; }
+        entry<K, V> & operator*() const { return *p; }
+        bool operator==(const iterator & u) const
+        { return u.p == p; }
+        bool operator!=(const iterator & u) const
+        { return u.p != p; }
+        iterator & operator++() {
+            do {
+                ++p;
+                ++c;
+            } while (*c < END);
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+    };
+private:
+    int capacity;
+    int n;
+    int deleted;
+    size_t mask;
+    signed char * ctrl;
+    entry<K, V> * slots;
+    H hash;
+public:
+    flat_dictionary(int cap = 3) : n(0), deleted(0) {
+        int groups = 1;
+        while (groups * (GROUP - GROUP / 8) < cap)
+            groups <<= 1;
+        allocate(groups);
+    }
+    flat_dictionary(const flat_dictionary<K, V, H> & dict)
+    : capacity(dict.capacity), n(dict.n), deleted(dict.deleted), mask(dict.mask) {
+        ctrl = new signed char [capacity + 1];
+        memcpy(ctrl, dict.ctrl, capacity + 1);
+        slots = new entry<K, V> [capacity];
+        for (int i = 0; i < capacity; i++)
+            slots[i] = dict.slots[i];
+    }
+    ~flat_dictionary() { delete [] ctrl; delete [] slots; }
+    flat_dictionary<K, V, H> & operator=(const flat_dictionary<K, V, H> & dict) {
+        flat_dictionary<K, V, H> copy = dict;
+        swap(ctrl, copy.ctrl);
+        swap(slots, copy.slots);
+        capacity = copy.capacity;
+        n = copy.n;
+        deleted = copy.deleted;
+        mask = copy.mask;
+        return *this;
+    }
+    V & operator[](const K & k) {
+        size_t x = mix64((unsigned) hash(k));
+        int i = finder(k, x);
+        if (i == -1) i = inserter(k, V(), x);
+        return slots[i]._value;
+    }
+    iterator find(const K & k) const {
+        int i = finder(k, mix64((unsigned) hash(k)));
+        if (i == -1) return end();
+        return iterator(slots + i, ctrl + i);
+    }
+    iterator insert(const K & k, const V & v) {
+        size_t x = mix64((unsigned) hash(k));
+        if (finder(k, x) != -1) return end();
+        int i = inserter(k, v, x);
+        return iterator(slots + i, ctrl + i);
+    }
+    void erase(const iterator & u)
+    { erase(u->key()); }
+    void erase(const K & k) {
+        int i = finder(k, mix64((unsigned) hash(k)));
+        if (i == -1) return;
+        // A probe only moves past a group without EMPTY slots, so the slot
+        // may become EMPTY again if its group still has one.
+        if (match(ctrl + (i & ~(GROUP - 1)), EMPTY))
+            ctrl[i] = EMPTY;
+        else {
+            ctrl[i] = DELETED;
+            deleted++;
+        }
+        slots[i] = entry<K, V>();
+        n--;
+    }
+    void clear() {
+        memset(ctrl, EMPTY, capacity);
+        for (int i = 0; i < capacity; i++)
+            slots[i] = entry<K, V>();
+        n = deleted = 0;
+    }
+    iterator begin() const {
+        int i = 0;
+        while (ctrl[i] < END) i++;
+        return iterator(slots + i, ctrl + i);
+    }
+    iterator end() const { return iterator(slots + capacity, ctrl + capacity); }
+    int size() const
+    { return n; }
+    bool empty() const
+    { return n == 0; }
+private:
+    static unsigned match(const signed char * g, signed char c) {
+#ifdef __SSE2__
+        __m128i u = _mm_loadu_si128((const __m128i *) g);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(u, _mm_set1_epi8(c)));
+#else
+        unsigned m = 0;
+        for (int i = 0; i < GROUP; i++)
+            if (g[i] == c) m |= 1u << i;
+        return m;
+#endif
+    }
+    static unsigned match_free(const signed char * g) {
+#ifdef __SSE2__
+        __m128i u = _mm_loadu_si128((const __m128i *) g);
+        return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(END), u));
+#else
+        unsigned m = 0;
+        for (int i = 0; i < GROUP; i++)
+            if (g[i] < END) m |= 1u << i;
+        return m;
+#endif
+    }
+    int finder(const K & k, size_t x) const {
+        signed char h2 = x & 0x7f;
+        size_t g = (x >> 7) & mask;
+        for (size_t step = 1; ; step++) {
+            const signed char * c = ctrl + g * GROUP;
+            for (unsigned m = match(c, h2); m; m &= m - 1) {
+                int i = g * GROUP + __builtin_ctz(m);
+                if (slots[i]._key == k) return i;
+            }
+            if (match(c, EMPTY)) return -1;
+            g = (g + step) & mask;
+        }
+    }
+    int free_slot(size_t x) const {
+        size_t g = (x >> 7) & mask;
+        for (size_t step = 1; ; step++) {
+            unsigned m = match_free(ctrl + g * GROUP);
+            if (m) return g * GROUP + __builtin_ctz(m);
+            g = (g + step) & mask;
+        }
+    }
+    int inserter(const K & k, const V & v, size_t x) {
+        if (n + deleted + 1 > capacity - capacity / 8) {
+            rehash(n + 1 > capacity / 2 ? (mask + 1) << 1 : mask + 1);
+        }
+        int i = free_slot(x);
+        if (ctrl[i] == DELETED) deleted--;
+        ctrl[i] = x & 0x7f;
+        slots[i]._key = k;
+        slots[i]._value = v;
+        n++;
+        return i;
+    }
+    void allocate(size_t groups) {
+        mask = groups - 1;
+        capacity = groups * GROUP;
+        ctrl = new signed char [capacity + 1];
+        memset(ctrl, EMPTY, capacity);
+        ctrl[capacity] = END;
+        slots = new entry<K, V> [capacity];
+    }
+    void rehash(size_t groups) {
+        int old_capacity = capacity;
+        signed char * old_ctrl = ctrl;
+        entry<K, V> * old_slots = slots;
+        allocate(groups);
+        for (int i = 0; i < old_capacity; i++)
+            if (old_ctrl[i] >= 0) {
+                size_t x = mix64((unsigned) hash(old_slots[i]._key));
+                int j = free_slot(x);
+                ctrl[j] = x & 0x7f;
+                slots[j]._key = move(old_slots[i]._key);
+                slots[j]._value = move(old_slots[i]._value);
+            }
+        deleted = 0;
+        delete [] old_ctrl;
+        delete [] old_slots;
+    }
+};
+
+/**
+ * Frozen Dictionary (Minimal Perfect Hashing)
+ * A read-only map built once from a dictionary or from a range of
+ * (key, value) pairs. Keys are spread over buckets of about 3; for every
+ * bucket, in decreasing order of size, a 16-bit pilot is searched so that
+ * its keys go to free slots of a table 2% larger than the number of keys.
+ * The few keys that land past the end are then moved to the holes, so the
+ * entries are dense. A lookup hashes the key once, reads the pilot of its
+ * bucket (the pilots take 5.3 bits per key and mostly stay in cache) and
+ * compares the one key in its slot. Keys whose hash codes (as returned by H)
+ * coincide with an earlier key cannot be told apart by the pilots; they are
+ * kept, sorted by hash code, after the perfectly hashed slots and binary
+ * searched.
+ * save and load write and read the table as is, so for trivially copyable
+ * K and V (and a hash functor that is the same in every process) it can be
+ * built offline.
+ */
+template <typename K, typename V, typename H>
+class frozen_dictionary {
+public:
+    typedef const entry<K, V> * iterator;
+private:
+    int n;
+    int d;
+    int m;
+    int buckets;
+    unsigned long long seed;
+    vector<unsigned short> pilot;
+    vector<int> remap;
+    vector<entry<K, V> > data;
+    vector<int> overflow;
+    H hash;
+public:
+    frozen_dictionary() : n(0), d(0), m(0), buckets(0), seed(0) { }
+    template <typename P>
+    frozen_dictionary(const dictionary<K, V, H, P> & dict) : frozen_dictionary() {
+        vector<entry<K, V> > v;
+        v.reserve(dict.size());
+        for (typename dictionary<K, V, H, P>::iterator u = dict.begin(); u != dict.end(); ++u)
+            v.push_back(*u);
+        build(v);
+    }
+    template <typename I>
+    frozen_dictionary(I first, I last) : frozen_dictionary() {
+        vector<entry<K, V> > v;
+        for ( ; first != last; ++first)
+            v.push_back(entry<K, V>(first->first, first->second));
+        build(v);
+    }
+    iterator find(const K & k) const {
+        if (n == 0) return end();
+        int h = hash(k);
+        const entry<K, V> * e = &data[slot(mix64((unsigned) h + seed))];
+        if (e->key() == k) return e;
+        if (d == n) return end();
+        int i = lower_bound(overflow.begin(), overflow.end(), h) - overflow.begin();
+        for ( ; i < n - d && overflow[i] == h; i++)
+            if (data[d + i].key() == k) return &data[d + i];
+        return end();
+    }
+    iterator begin() const { return data.data(); }
+    iterator end() const { return data.data() + n; }
+    int size() const
+    { return n; }
+    bool empty() const
+    { return n == 0; }
+    /**
+     * File layout: magic, version, sizeof(K), sizeof(V), n, d, m, buckets,
+     * seed, then the pilots, the remapped slots, the n entries and the
+     * n - d overflow hash codes. load returns false (leaving the dictionary
+     * empty) if the header does not match, the file is short, or a slot or
+     * the overflow order is out of range.
+     */
+    bool save(FILE * f) const {
+        static_assert(is_trivially_copyable<K>::value && is_trivially_copyable<V>::value,
+                      "frozen_dictionary::save needs trivially copyable K and V");
+        int header[] = { MAGIC, VERSION, (int) sizeof(K), (int) sizeof(V), n, d, m, buckets };
+        return fwrite(header, sizeof(header), 1, f) == 1 && write(f, &seed, 1)
+            && write(f, pilot.data(), buckets) && write(f, remap.data(), m - d)
+            && write(f, data.data(), n) && write(f, overflow.data(), n - d);
+    }
+    bool load(FILE * f) {
+        static_assert(is_trivially_copyable<K>::value && is_trivially_copyable<V>::value,
+                      "frozen_dictionary::load needs trivially copyable K and V");
+        frozen_dictionary<K, V, H> t;
+        int header[8];
+        bool ok = fread(header, sizeof(header), 1, f) == 1
+               && header[0] == MAGIC && header[1] == VERSION
+               && header[2] == (int) sizeof(K) && header[3] == (int) sizeof(V)
+               && 0 <= header[5] && header[5] <= header[4] && header[5] <= header[6]
+               && header[7] >= 0 && (header[5] == 0 || header[7] > 0);
+        if (ok) {
+            t.n = header[4];
+            t.d = header[5];
+            t.m = header[6];
+            t.buckets = header[7];
+            t.pilot.resize(t.buckets);
+            t.remap.resize(t.m - t.d);
+            t.data.resize(t.n);
+            t.overflow.resize(t.n - t.d);
+            ok = read(f, &t.seed, 1) && read(f, t.pilot.data(), t.buckets)
+              && read(f, t.remap.data(), t.m - t.d) && read(f, t.data.data(), t.n)
+              && read(f, t.overflow.data(), t.n - t.d);
+        }
+        if (ok) {
+            ok = (t.n == 0 || t.d > 0)
+              && is_sorted(t.overflow.begin(), t.overflow.end());
+            for (int i = 0; i < t.m - t.d && ok; i++)
+                ok = 0 <= t.remap[i] && t.remap[i] < t.d;
+        }
+        if (!ok) t = frozen_dictionary<K, V, H>();
+        swap(*this, t);
+        return ok;
+    }
+private:
+    enum { MAGIC = 0x4d504846, VERSION = 1, BUCKET_SIZE = 3 };
+    template <typename T>
+    static bool write(FILE * f, const T * p, int c)
+    { return c == 0 || fwrite(p, sizeof(T), c, f) == (size_t) c; }
+    template <typename T>
+    static bool read(FILE * f, T * p, int c)
+    { return c == 0 || fread(p, sizeof(T), c, f) == (size_t) c; }
+    static int reduce(unsigned long long x, int c)
+    { return ((unsigned __int128) x * (unsigned) c) >> 64; }
+    static int place(unsigned long long x, unsigned p, int c)
+    { return reduce(mix64(x ^ p * 0x9E3779B97F4A7C15ULL), c); }
+    int slot(unsigned long long x) const {
+        int i = place(x, pilot[reduce(x, buckets)], m);
+        return i < d ? i : remap[i - d];
+    }
+    void build(vector<entry<K, V> > & v) {
+        // Sort by hash code; the first of equal keys wins, and the other
+        // keys sharing a hash code go to the overflow part.
+        vector<pair<int, int> > a(v.size());
+        for (int i = 0; i < (int) v.size(); i++)
+            a[i] = make_pair(hash(v[i].key()), i);
+        sort(a.begin(), a.end());
+        vector<pair<int, int> > unique, rest;
+        for (int i = 0, j; i < (int) a.size(); i = j) {
+            unique.push_back(a[i]);
+            for (j = i + 1; j < (int) a.size() && a[j].first == a[i].first; j++) {
+                bool seen = v[a[j].second].key() == v[a[i].second].key();
+                for (int l = i + 1; l < j && !seen; l++)
+                    seen = v[a[j].second].key() == v[a[l].second].key();
+                if (!seen) rest.push_back(a[j]);
+            }
+        }
+        d = unique.size();
+        n = d + rest.size();
+        m = d + d / 50;
+        buckets = max(1, (d + BUCKET_SIZE - 1) / BUCKET_SIZE);
+        vector<int> where;
+        for (seed = 0; !place_all(unique, where); seed += 0x9E3779B97F4A7C15ULL)
+            ;
+        // Slots past d are remapped to the holes below d, in order.
+        remap.assign(m - d, 0);
+        for (int i = d, j = 0; i < m; i++)
+            if (where[i] != -1) {
+                while (where[j] != -1) j++;
+                remap[i - d] = j;
+                where[j] = where[i];
+            }
+        data.assign(n, entry<K, V>());
+        for (int i = 0; i < d; i++)
+            data[i] = v[unique[where[i]].second];
+        overflow.resize(rest.size());
+        for (int i = 0; i < (int) rest.size(); i++) {
+            overflow[i] = rest[i].first;
+            data[d + i] = v[rest[i].second];
+        }
+    }
+    // Searches the pilots for the current seed; false if some bucket has
+    // no 16-bit pilot that fits.
+    bool place_all(const vector<pair<int, int> > & unique, vector<int> & where) {
+        vector<int> start(buckets + 1, 0), order(buckets), member(d);
+        vector<unsigned long long> x(d);
+        for (int i = 0; i < d; i++) {
+            x[i] = mix64((unsigned) unique[i].first + seed);
+            start[reduce(x[i], buckets) + 1]++;
+        }
+        for (int b = 0; b < buckets; b++)
+            start[b + 1] += start[b];
+        vector<int> fill(start.begin(), start.end() - 1);
+        for (int i = 0; i < d; i++)
+            member[fill[reduce(x[i], buckets)]++] = i;
+        for (int b = 0; b < buckets; b++)
+            order[b] = b;
+        stable_sort(order.begin(), order.end(), [&](int p, int q)
+                    { return start[p + 1] - start[p] > start[q + 1] - start[q]; });
+        // Taken slots are kept in a bit set, which stays in cache while
+        // the pilots of the last buckets are searched.
+        pilot.assign(buckets, 0);
+        where.assign(m, -1);
+        vector<unsigned long long> taken((m + 63) / 64, 0);
+        vector<int> pos;
+        for (int o = 0; o < buckets; o++) {
+            int b = order[o], s = start[b], c = start[b + 1] - s;
+            if (c == 0) break;
+            if (c > (int) pos.size()) pos.resize(c);
+            for (unsigned p = 0; ; p++) {
+                if (p > USHRT_MAX) return false;
+                bool ok = true;
+                for (int i = 0; i < c && ok; i++) {
+                    pos[i] = place(x[member[s + i]], p, m);
+                    ok = !(taken[pos[i] >> 6] >> (pos[i] & 63) & 1);
+                    for (int j = 0; j < i && ok; j++)
+                        ok = pos[j] != pos[i];
+                }
+                if (!ok) continue;
+                pilot[b] = p;
+                for (int i = 0; i < c; i++) {
+                    taken[pos[i] >> 6] |= 1ULL << (pos[i] & 63);
+                    where[pos[i]] = member[s + i];
+                }
+                break;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * Blocked Bloom Filter
+ * Approximate set membership: contains(k) is always true for an inserted
+ * key and true with probability about fpr for any other key. Each key sets
+ * its bits inside one 64-byte block (one cache line), picked by the top of
+ * its mixed hash, so a query costs a single cache miss. Keys cannot be
+ * removed; erase only reports that.
+ * n is the number of keys the filter is sized for, fpr the target false
+ * positive rate at n keys.
+ */
+template <typename K, typename H>
+class blocked_bloom_filter {
+private:
+    enum { WORDS = 8, MAX_BITS = 16 };
+    int blocks;
+    int bits;
+    int cap;
+    unsigned long long * raw;
+    unsigned long long * block;
+    H hash;
+public:
+    blocked_bloom_filter(int n = 1024, double fpr = 0.01) : cap(max(n, 1)) {
+        // A block is less uniform than the whole array, so use a bit more
+        // memory than an ordinary Bloom filter would need.
+        double per_key = -log(fpr) / (log(2.0) * log(2.0)) * 1.15;
+        bits = max(1, min((int) MAX_BITS, (int) round(per_key * log(2.0))));
+        blocks = max(1, (int) ceil(per_key * cap / (WORDS * 64)));
+        allocate();
+        memset(block, 0, sizeof(unsigned long long) * WORDS * blocks);
+    }
+    blocked_bloom_filter(const blocked_bloom_filter<K, H> & f)
+    : blocks(f.blocks), bits(f.bits), cap(f.cap) {
+        allocate();
+        memcpy(block, f.block, sizeof(unsigned long long) * WORDS * blocks);
+    }
+    ~blocked_bloom_filter() { delete [] raw; }
+    blocked_bloom_filter<K, H> & operator=(blocked_bloom_filter<K, H> f) {
+        swap(blocks, f.blocks);
+        swap(bits, f.bits);
+        swap(cap, f.cap);
+        swap(raw, f.raw);
+        swap(block, f.block);
+        return *this;
+    }
+    bool insert(const K & k) {
+        unsigned long long x = mix64((unsigned) hash(k));
+        unsigned long long * b = block + reduce(x) * WORDS;
+        for (int i = 0; i < bits; i++) {
+            unsigned j = position(x, i);
+            b[j >> 6] |= 1ULL << (j & 63);
+        }
+        return true;
+    }
+    bool contains(const K & k) const {
+        unsigned long long x = mix64((unsigned) hash(k));
+        const unsigned long long * b = block + reduce(x) * WORDS;
+        unsigned long long miss = 0;
+        for (int i = 0; i < bits; i++) {
+            unsigned j = position(x, i);
+            miss |= ~b[j >> 6] & 1ULL << (j & 63);
+        }
+        return miss == 0;
+    }
+    bool erase(const K &) { return false; }
+    void clear() { memset(block, 0, sizeof(unsigned long long) * WORDS * blocks); }
+    int capacity() const { return cap; }
+private:
+    size_t reduce(unsigned long long x) const
+    { return ((x >> 32) * (unsigned) blocks) >> 32; }
+    // The i-th of the 512 bit positions of x inside its block.
+    static unsigned position(unsigned long long x, int i) {
+        static const unsigned salt[MAX_BITS] = {
+            0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+            0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+            0x9e3779b9U, 0x85ebca6bU, 0xc2b2ae35U, 0x27d4eb2fU,
+            0x165667b1U, 0xd3a2646dU, 0xfd7046c5U, 0xb55a4f09U
+        };
+        return ((unsigned) x * salt[i]) >> 23;
+    }
+    void allocate() {
+        raw = new unsigned long long [WORDS * (blocks + 1)];
+        block = (unsigned long long *) (((uintptr_t) raw + 63) & ~(uintptr_t) 63);
+    }
+};
+
+/**
+ * Cuckoo Filter
+ * Approximate set membership with deletion. Every key is reduced to a short
+ * fingerprint stored in one of two buckets of 4 slots; the second bucket is
+ * the first one xor a hash of the fingerprint, so a fingerprint can be moved
+ * to its other bucket without knowing the key (partial-key cuckoo hashing).
+ * insert returns false when the filter is too full (it is sized for about
+ * 95% load at n keys). erase must only be called for keys that were
+ * inserted, otherwise it may remove the fingerprint of another key.
+ */
+template <typename K, typename H>
+class cuckoo_filter {
+private:
+    enum { SLOTS = 4, MAX_KICKS = 500 };
+    int n;
+    int cap;
+    unsigned fmask;
+    size_t mask;
+    unsigned short * table;
+    unsigned short victim;
+    size_t victim_index;
+    unsigned rnd;
+    H hash;
+public:
+    cuckoo_filter(int _n = 1024, double fpr = 0.01) : n(0), victim(0), victim_index(0), rnd(2463534242U) {
+        // A lookup compares against 2 * SLOTS fingerprints.
+        int fbits = max(4, min(16, (int) ceil(log2(2 * SLOTS / fpr))));
+        fmask = (1U << fbits) - 1;
+        size_t buckets = 1;
+        while (buckets * SLOTS * 95 < (size_t) max(_n, 1) * 100)
+            buckets <<= 1;
+        mask = buckets - 1;
+        cap = buckets * SLOTS * 95 / 100;
+        table = new unsigned short [buckets * SLOTS];
+        memset(table, 0, sizeof(unsigned short) * buckets * SLOTS);
+    }
+    cuckoo_filter(const cuckoo_filter<K, H> & f)
+    : n(f.n), cap(f.cap), fmask(f.fmask), mask(f.mask),
+      victim(f.victim), victim_index(f.victim_index), rnd(f.rnd) {
+        table = new unsigned short [(mask + 1) * SLOTS];
+        memcpy(table, f.table, sizeof(unsigned short) * (mask + 1) * SLOTS);
+    }
+    ~cuckoo_filter() { delete [] table; }
+    cuckoo_filter<K, H> & operator=(cuckoo_filter<K, H> f) {
+        swap(n, f.n);
+        swap(cap, f.cap);
+        swap(fmask, f.fmask);
+        swap(mask, f.mask);
+        swap(table, f.table);
+        swap(victim, f.victim);
+        swap(victim_index, f.victim_index);
+        swap(rnd, f.rnd);
+        return *this;
+    }
+    bool insert(const K & k) {
+        if (victim != 0) return false;
+        unsigned short f;
+        size_t i;
+        locate(k, f, i);
+        place(i, f);
+        n++;
+        return true;
+    }
+    bool contains(const K & k) const {
+        unsigned short f;
+        size_t i;
+        locate(k, f, i);
+        size_t j = alt(i, f);
+        if (victim == f && (victim_index == i || victim_index == j))
+            return true;
+        const unsigned short * a = table + i * SLOTS, * b = table + j * SLOTS;
+        return (a[0] == f) | (a[1] == f) | (a[2] == f) | (a[3] == f)
+             | (b[0] == f) | (b[1] == f) | (b[2] == f) | (b[3] == f);
+    }
+    bool erase(const K & k) {
+        unsigned short f;
+        size_t i;
+        locate(k, f, i);
+        size_t j = alt(i, f);
+        if (victim == f && (victim_index == i || victim_index == j)) {
+            victim = 0;
+            n--;
+            return true;
+        }
+        if (!take(i, f) && !take(j, f)) return false;
+        n--;
+        if (victim != 0) {
+            // Room was made; try to put the victim back.
+            unsigned short v = victim;
+            victim = 0;
+            place(victim_index, v);
+        }
+        return true;
+    }
+    void clear() {
+        memset(table, 0, sizeof(unsigned short) * (mask + 1) * SLOTS);
+        n = 0;
+        victim = 0;
+    }
+    int size() const { return n; }
+    int capacity() const { return cap; }
+private:
+    void locate(const K & k, unsigned short & f, size_t & i) const {
+        unsigned long long x = mix64((unsigned) hash(k));
+        f = (x >> 32) & fmask;
+        if (f == 0) f = 1;
+        i = x & mask;
+    }
+    size_t alt(size_t i, unsigned short f) const
+    { return (i ^ (f * 0x5bd1e995U)) & mask; }
+    bool put(size_t i, unsigned short f) {
+        unsigned short * a = table + i * SLOTS;
+        for (int s = 0; s < SLOTS; s++)
+            if (a[s] == 0) {
+                a[s] = f;
+                return true;
+            }
+        return false;
+    }
+    bool take(size_t i, unsigned short f) {
+        unsigned short * a = table + i * SLOTS;
+        for (int s = 0; s < SLOTS; s++)
+            if (a[s] == f) {
+                a[s] = 0;
+                return true;
+            }
+        return false;
+    }
+    // Kicks random fingerprints to their other bucket until one finds a
+    // free slot. If that fails, the last one kicked out is kept aside as
+    // the victim, so no key is lost.
+    void place(size_t i, unsigned short f) {
+        if (put(i, f) || put(alt(i, f), f)) return;
+        for (int kick = 0; kick < MAX_KICKS; kick++) {
+            rnd ^= rnd << 13;
+            rnd ^= rnd >> 17;
+            rnd ^= rnd << 5;
+            swap(f, table[i * SLOTS + rnd % SLOTS]);
+            i = alt(i, f);
+            if (put(i, f)) return;
+        }
+        victim = f;
+        victim_index = i;
+    }
+};
+
+/**
+ * Filtered Dictionary
+ * A dictionary fronted by an approximate-membership filter F (by default
+ * blocked_bloom_filter, or cuckoo_filter to support deletion). find checks
+ * the filter first and only walks the dictionary for keys the filter may
+ * contain, so most misses never touch bucket or data. The filter is rebuilt
+ * from the keys, at twice the size, when it fills up or rejects an insert.
+ * A filter that cannot erase keeps the erased keys until the next rebuild,
+ * counting them against its capacity.
+ * F needs F(n, fpr), insert, contains, erase (false if unsupported), clear
+ * and capacity.
+ */
+template <typename K, typename V, typename H, typename F = blocked_bloom_filter<K, H>,
+          typename P = prime_growth>
+class filtered_dictionary {
+public:
+    typedef typename dictionary<K, V, H, P>::iterator iterator;
+private:
+    dictionary<K, V, H, P> dict;
+    F filter;
+    double fpr;
+    int stale;
+public:
+    filtered_dictionary(int cap = 3, double _fpr = 0.01)
+    : dict(cap), filter(max(cap, 64), _fpr), fpr(_fpr), stale(0) { }
+    V & operator[](const K & k) {
+        pair<iterator, bool> r = dict.try_emplace(k);
+        if (r.second) add(k);
+        return r.first->_value;
+    }
+    iterator find(const K & k) const {
+        if (!filter.contains(k)) return dict.end();
+        return dict.find(k);
+    }
+    iterator insert(const K & k, const V & v) {
+        iterator u = dict.insert(k, v);
+        if (u != dict.end()) add(k);
+        return u;
+    }
+    void erase(const iterator & u)
+    { erase(u->key()); }
+    void erase(const K & k) {
+        int m = dict.size();
+        dict.erase(k);
+        if (dict.size() != m && !filter.erase(k))
+            stale++;
+    }
+    void clear() {
+        dict.clear();
+        filter.clear();
+        stale = 0;
+    }
+    iterator begin() const { return dict.begin(); }
+    iterator end() const { return dict.end(); }
+    int size() const
+    { return dict.size(); }
+    bool empty() const
+    { return dict.empty(); }
+private:
+    void add(const K & k) {
+        if (dict.size() + stale > filter.capacity() || !filter.insert(k))
+            rebuild();
+    }
+    // A filter that rejects a key would answer false for it, so the size
+    // keeps doubling until every key fits.
+    void rebuild() {
+        for (int c = max(2 * dict.size(), 64); ; c *= 2) {
+            filter = F(c, fpr);
+            iterator u = dict.begin();
+            while (u != dict.end() && filter.insert(u->key()))
+                ++u;
+            if (u == dict.end()) break;
+        }
+        stale = 0;
+    }
+};
+
+/**
+ * Count-Min Sketch
+ * Frequency estimates of a stream in fixed memory: depth rows of width
+ * counters, each key adds its count to one counter per row, and estimate
+ * returns the smallest of them. The estimate never undercounts, and
+ * overcounts by more than e / width * total with probability at most
+ * exp(-depth). Sketches with the same width and depth can be merged
+ * (added up); merge returns false otherwise.
+ */
+template <typename K, typename H>
+class count_min_sketch {
+private:
+    int width;
+    int depth;
+    long long total;
+    vector<long long> table;
+    H hash;
+public:
+    count_min_sketch(int _width = 2048, int _depth = 4)
+    : width(max(_width, 1)), depth(max(_depth, 1)), total(0), table((size_t) width * depth, 0) { }
+    void update(const K & k, long long c = 1) {
+        unsigned long long x = mix64((unsigned) hash(k));
+        for (int i = 0; i < depth; i++)
+            table[(size_t) i * width + column(x, i)] += c;
+        total += c;
+    }
+    long long estimate(const K & k) const {
+        unsigned long long x = mix64((unsigned) hash(k));
+        long long e = table[column(x, 0)];
+        for (int i = 1; i < depth; i++)
+            e = min(e, table[(size_t) i * width + column(x, i)]);
+        return e;
+    }
+    bool merge(const count_min_sketch<K, H> & s) {
+        if (s.width != width || s.depth != depth) return false;
+        for (size_t i = 0; i < table.size(); i++)
+            table[i] += s.table[i];
+        total += s.total;
+        return true;
+    }
+    void clear() {
+        fill(table.begin(), table.end(), 0);
+        total = 0;
+    }
+    long long count() const { return total; }
+private:
+    // Row i uses the hash (a + i * b), with a and b the two halves of x.
+    int column(unsigned long long x, int i) const {
+        unsigned y = (unsigned) x + (unsigned) i * ((unsigned) (x >> 32) | 1);
+        return ((unsigned long long) y * (unsigned) width) >> 32;
+    }
+};
+
+/**
+ * HyperLogLog
+ * Estimates the number of distinct keys of a stream with 2^p one-byte
+ * registers (p from 4 to 16), within about 1.04 / sqrt(2^p) relative
+ * error. Small counts use linear counting over the empty registers.
+ * Sketches with the same p are merged by taking the maximum of each
+ * register; merge returns false otherwise.
+ */
+template <typename K, typename H>
+class hyperloglog {
+private:
+    int p;
+    vector<unsigned char> reg;
+    H hash;
+public:
+    hyperloglog(int _p = 14) : p(max(4, min(16, _p))), reg(1 << p, 0) { }
+    void insert(const K & k) {
+        unsigned long long x = mix64((unsigned) hash(k));
+        int i = x >> (64 - p);
+        // Rank of the first set bit in the remaining 64 - p bits.
+        unsigned long long w = x << p | 1ULL << (p - 1);
+        unsigned char r = __builtin_clzll(w) + 1;
+        if (r > reg[i]) reg[i] = r;
+    }
+    double estimate() const {
+        int m = 1 << p, zeros = 0;
+        double sum = 0;
+        for (int i = 0; i < m; i++) {
+            sum += ldexp(1.0, -reg[i]);
+            zeros += reg[i] == 0;
+        }
+        double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709
+                     : 0.7213 / (1 + 1.079 / m);
+        double e = alpha * m * m / sum;
+        if (e <= 2.5 * m && zeros > 0)
+            e = m * log((double) m / zeros);
+        return e;
+    }
+    bool merge(const hyperloglog<K, H> & s) {
+        if (s.p != p) return false;
+        for (size_t i = 0; i < reg.size(); i++)
+            reg[i] = max(reg[i], s.reg[i]);
+        return true;
+    }
+    void clear() { fill(reg.begin(), reg.end(), 0); }
+};
+
+/**
+ * Space-Saving (Top-k Heavy Hitters)
+ * Keeps k counters. A key with a counter adds to it; a new key takes over
+ * the smallest counter, inheriting its count as the error bound. Every key
+ * whose true frequency exceeds total / k is guaranteed to be kept, and for
+ * a kept key count - error <= true frequency <= count. Counters are found
+ * through a dictionary and kept in a min-heap, so an update is O(log k).
+ * top() lists the counters by decreasing count. merge combines two
+ * summaries into one with the same guarantees over both streams (keys
+ * missing from a full summary are charged that summary's minimum).
+ */
+template <typename K, typename H>
+class space_saving {
+public:
+    struct counter {
+        K key;
+        long long count;
+        long long error;
+    };
+private:
+    int k;
+    long long total;
+    vector<counter> heap;
+    dictionary<K, int, H> index;
+public:
+    space_saving(int _k = 100) : k(max(_k, 1)), total(0) { }
+    void update(const K & key, long long c = 1) {
+        total += c;
+        typename dictionary<K, int, H>::iterator u = index.find(key);
+        if (u != index.end()) {
+            int i = u->value();
+            heap[i].count += c;
+            sift_down(i);
+        } else if ((int) heap.size() < k) {
+            counter t = { key, c, 0 };
+            heap.push_back(t);
+            index.insert(key, heap.size() - 1);
+            sift_up(heap.size() - 1);
+        } else {
+            index.erase(heap[0].key);
+            heap[0].error = heap[0].count;
+            heap[0].count += c;
+            heap[0].key = key;
+            index.insert(key, 0);
+            sift_down(0);
+        }
+    }
+    vector<counter> top() const {
+        vector<counter> r = heap;
+        sort(r.begin(), r.end(), [](const counter & a, const counter & b)
+             { return a.count > b.count; });
+        return r;
+    }
+    bool merge(const space_saving<K, H> & s) {
+        if (s.k != k) return false;
+        long long m1 = (int) heap.size() < k ? 0 : heap[0].count;
+        long long m2 = (int) s.heap.size() < k ? 0 : s.heap[0].count;
+        dictionary<K, int, H> pos;
+        vector<counter> all;
+        for (size_t i = 0; i < heap.size(); i++) {
+            counter t = heap[i];
+            t.count += m2;
+            t.error += m2;
+            pos.insert(t.key, all.size());
+            all.push_back(t);
+        }
+        for (size_t i = 0; i < s.heap.size(); i++) {
+            typename dictionary<K, int, H>::iterator u = pos.find(s.heap[i].key);
+            if (u != pos.end()) {
+                counter & t = all[u->value()];
+                t.count += s.heap[i].count - m2;
+                t.error += s.heap[i].error - m2;
+            } else {
+                counter t = s.heap[i];
+                t.count += m1;
+                t.error += m1;
+                all.push_back(t);
+            }
+        }
+        sort(all.begin(), all.end(), [](const counter & a, const counter & b)
+             { return a.count > b.count; });
+        if ((int) all.size() > k) all.resize(k);
+        heap.clear();
+        index.clear();
+        total += s.total;
+        for (size_t i = 0; i < all.size(); i++) {
+            heap.push_back(all[i]);
+            index.insert(all[i].key, heap.size() - 1);
+            sift_up(heap.size() - 1);
+        }
+        return true;
+    }
+    void clear() {
+        heap.clear();
+        index.clear();
+        total = 0;
+    }
+    long long count() const { return total; }
+private:
+    void place(int i, const counter & t) {
+        heap[i] = t;
+        index[t.key] = i;
+    }
+    void sift_up(int i) {
+        counter t = heap[i];
+        while (i > 0 && heap[(i - 1) / 2].count > t.count) {
+            place(i, heap[(i - 1) / 2]);
+            i = (i - 1) / 2;
+        }
+        place(i, t);
+    }
+    void sift_down(int i) {
+        counter t = heap[i];
+        int m = heap.size();
+        for (int c = 2 * i + 1; c < m; i = c, c = 2 * i + 1) {
+            if (c + 1 < m && heap[c + 1].count < heap[c].count) c++;
+            if (heap[c].count >= t.count) break;
+            place(i, heap[c]);
+        }
+        place(i, t);
+    }
+};
+
+/**
+ * Eviction Policies for bounded_cache
+ * Slots are numbered 0 .. c - 1 (reset(c)). insert(i) and erase(i) are
+ * called when slot i gets or loses an entry, touch(i) on every hit, and
+ * victim() picks the slot to evict when all are in use.
+ * lru_eviction: an intrusive doubly linked list in recency order; a hit
+ * moves the slot to the front, the victim is the back.
+ * clock_eviction: one reference byte per slot and a hand; a hit only sets
+ * the byte, and the hand clears set bytes until it finds a clear one. A
+ * hit costs one store instead of six, at the price of approximating LRU.
+ */
+struct lru_eviction {
+    vector<int> prev, next;
+    int head;
+    void reset(int c) {
+        prev.assign(c + 1, c);
+        next.assign(c + 1, c);
+        head = c;
+    }
+    void insert(int i) {
+        next[i] = next[head];
+        prev[i] = head;
+        prev[next[head]] = i;
+        next[head] = i;
+    }
+    void erase(int i) {
+        next[prev[i]] = next[i];
+        prev[next[i]] = prev[i];
+    }
+    void touch(int i) {
+        if (next[head] == i) return;
+        erase(i);
+        insert(i);
+    }
+    int victim() { return prev[head]; }
+};
+struct clock_eviction {
+    enum { FREE, USED, REFERENCED };
+    vector<unsigned char> ref;
+    int hand;
+    void reset(int c) {
+        ref.assign(c, FREE);
+        hand = 0;
+    }
+    void insert(int i) { ref[i] = REFERENCED; }
+    void erase(int i) { ref[i] = FREE; }
+    void touch(int i) { ref[i] = REFERENCED; }
+    int victim() {
+        for ( ; ; hand = hand + 1 == (int) ref.size() ? 0 : hand + 1) {
+            if (ref[hand] == USED) return hand;
+            if (ref[hand] == REFERENCED) ref[hand] = USED;
+        }
+    }
+};
+
+/**
+ * Bounded Cache
+ * A hash table of at most c entries for memoization. The nodes are
+ * allocated once and chained from the buckets as in dictionary; when the
+ * cache is full, insert evicts the entry chosen by the policy E in O(1)
+ * and reuses its node, so entries never move. find counts hits and
+ * misses, and a hit tells the policy that the entry was used.
+ * fetch(k, f) returns the cached value of k, computing and caching f(k)
+ * on a miss. It returns a copy: the node may be reused by the next insert,
+ * including one made by a recursive fetch inside f.
+ */
+template <typename K, typename V, typename H, typename E = lru_eviction>
+class bounded_cache {
+private:
+    struct node {
+        int hash_code;
+        entry<K, V> ent;
+        int next;
+        bool is_end;
+        node() : hash_code(-1), ent(), next(-1), is_end(false) { }
+    };
+public:
+    class iterator {
+    private:
+        node * p;
+    public:
+        iterator(node * _p = NULL) : p(_p) { }
+        entry<K, V> * operator->() const { return &p->ent; }
+        entry<K, V> & operator*() const { return p->ent; }
+        bool operator==(const iterator & u) const
+        { return u.p == p; }
+        bool operator!=(const iterator & u) const
+        { return u.p != p; }
+        iterator & operator++() {
+            do {
+                ++p;
+            } while (!p->is_end && p->hash_code == -1);
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+    };
+private:
+    int cap;
+    int n;
+    int free_list;
+    int * bucket;
+    node * data;
+    long long hit, miss, evicted;
+    prime_growth growth;
+    E evict;
+    H hash;
+public:
+    bounded_cache(int c = 1024) : cap(max(c, 1)) {
+        growth.reset(growth.capacity(cap));
+        bucket = new int [growth.cap];
+        data = new node [cap + 1];
+        data[cap].is_end = true;
+        clear();
+    }
+    bounded_cache(const bounded_cache<K, V, H, E> &) = delete;
+    bounded_cache<K, V, H, E> & operator=(const bounded_cache<K, V, H, E> &) = delete;
+    ~bounded_cache() { delete [] bucket; delete [] data; }
+    iterator find(const K & k) {
+        int b, p, i = finder(k, hash(k), b, p);
+        if (i == -1) {
+            miss++;
+            return end();
+        }
+        hit++;
+        evict.touch(i);
+        return iterator(data + i);
+    }
+    iterator insert(const K & k, const V & v) {
+        int h = hash(k), b, p;
+        if (finder(k, h, b, p) != -1) return end();
+        if (n == cap) {
+            int j = evict.victim();
+            remove(j);
+            evicted++;
+        }
+        int i = free_list;
+        free_list = data[i].next;
+        data[i].hash_code = h;
+        data[i].ent._key = k;
+        data[i].ent._value = v;
+        data[i].next = bucket[b];
+        bucket[b] = i;
+        evict.insert(i);
+        n++;
+        return iterator(data + i);
+    }
+    template <typename F>
+    V fetch(const K & k, F f) {
+        iterator u = find(k);
+        if (u != end()) return u->value();
+        u = insert(k, f(k));
+        if (u == end()) {
+            // f(k) has cached k itself.
+            int b, p, i = finder(k, hash(k), b, p);
+            return data[i].ent._value;
+        }
+        return u->value();
+    }
+    void erase(const K & k) {
+        int b, p, i = finder(k, hash(k), b, p);
+        if (i != -1) remove(i);
+    }
+    void clear() {
+        memset(bucket, -1, sizeof(int) * growth.cap);
+        for (int i = 0; i < cap; i++) {
+            data[i].hash_code = -1;
+            data[i].ent = entry<K, V>();
+            data[i].next = i + 1 < cap ? i + 1 : -1;
+        }
+        n = 0;
+        free_list = 0;
+        hit = miss = evicted = 0;
+        evict.reset(cap);
+    }
+    iterator begin() const {
+        node * u = data;
+        while (!u->is_end && u->hash_code == -1)
+            u++;
+        return iterator(u);
+    }
+    iterator end() const { return iterator(data + cap); }
+    int size() const
+    { return n; }
+    int capacity() const
+    { return cap; }
+    bool empty() const
+    { return n == 0; }
+    long long hits() const { return hit; }
+    long long misses() const { return miss; }
+    long long evictions() const { return evicted; }
+    void reset_stats() { hit = miss = evicted = 0; }
+private:
+    // Index of k (or -1), its bucket b, and the node before it in the chain (or -1).
+    int finder(const K & k, int h, int & b, int & p) const {
+        b = growth.index(h);
+        p = -1;
+        for (int i = bucket[b]; i != -1; p = i, i = data[i].next)
+            if (data[i].hash_code == h && data[i].ent._key == k)
+                return i;
+        return -1;
+    }
+    void remove(int i) {
+        int b, p;
+        finder(data[i].ent._key, data[i].hash_code, b, p);
+        if (p == -1) bucket[b] = data[i].next;
+        else data[p].next = data[i].next;
+        evict.erase(i);
+        data[i].hash_code = -1;
+        data[i].ent = entry<K, V>();
+        data[i].next = free_list;
+        free_list = i;
+        n--;
+    }
+};
+
+template <typename K, typename V>
+class skip_list {
+private:
+    struct node {
+        entry<K, V> ent;
+        node * before;
+        node * after;
+        node * above;
+        node * below;
+        int height;
+        node() : ent(), before(NULL), after(NULL), above(NULL), below(NULL), height(0) { }
+    };
+public:
+    class iterator {
+    public:
+        iterator(node * _p = NULL) : p(_p) { }
+        entry<K, V> & operator*() { return p->ent; }
+        entry<K, V> & operator*() const { return p->ent; }
+        entry<K, V> * operator->() { return &p->ent; }
+        entry<K, V> * operator->() const { return &p->ent; }
+        bool operator==(const iterator & v) const
+        { return p == v.p; }
+        bool operator!=(const iterator & v) const
+        { return p != v.p; }
+        iterator & operator++() {
+            p = p->after;
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        friend class skip_list<K, V>;
+    private:
+        node * p;
+    };
+public:
+    skip_list() : n(0) { create(); }
+    ~skip_list() { destroy(); }
+    V & operator[](const K & k) {
+        iterator u = finder(k);
+        if (u.p == root || u->key() != k)
+            return inserter(u, k, V())->_value;
+        else return u->_value;
+    }
+    iterator find(const K & k) {
+        iterator u = finder(k);
+        if (u.p == root || u->key() != k) return end();
+        return u;
+    }
+    iterator insert(const K & k, const V & v) {
+        iterator u = finder(k);
+        if (u.p != root && u->key() == k) return end();
+        return inserter(u, k, v);
+    }
+    void erase(const K & k) {
+        iterator u = finder(k);
+        if (u.p != root && u->key() == k)
+            erase(u);
+    }
+    void erase(const iterator & p) {
+        node * u = p.p;
+        do {
+            node * v = u->above;
+            u->before->after = u->after;
+            u->after->before = u->before;
+            delete u;
+            u = v;
+        } while (u != NULL);
+        n--;
+    }
+    void clear() {
+        destroy();
+        create();
+        n = 0;
+    }
+    /**
+     * Replaces the contents with the sorted range [first, last) of
+     * (key, value) pairs in O(n). The i-th key gets a tower of height
+     * 1 + ctz(i), the shape of a perfectly balanced skip list, instead of
+     * a random one. A key not greater than the previous one is skipped.
+     */
+    template <typename I>
+    void build(I first, I last) {
+        clear();
+        vector<node *> tail(1, root);
+        for ( ; first != last; ++first) {
+            if (n > 0 && !(tail[0]->ent._key < first->first)) continue;
+            n++;
+            int h = 1 + __builtin_ctz(n);
+            node * t = NULL;
+            for (int l = 0; l < h; l++) {
+                if (l == (int) tail.size()) {
+                    add_row();
+                    tail.push_back(highest_root);
+                }
+                node * tt = t;
+                t = insert_after(tail[l], first->first, l == 0 ? first->second : V());
+                if (tt != NULL) {
+                    t->below = tt;
+                    tt->above = t;
+                }
+                tail[l] = t;
+            }
+        }
+        if (tail.back() != highest_root)
+            add_row();
+    }
+    /**
+     * lower_bound(k): the first entry whose key is not less than k.
+     * upper_bound(k): the first entry whose key is greater than k.
+     * range(lo, hi): the entries with lo <= key < hi, as [first, second).
+     */
+    iterator lower_bound(const K & k) {
+        node * v = bound(k, false);
+        return iterator(v->after);
+    }
+    iterator upper_bound(const K & k) {
+        node * v = bound(k, true);
+        return iterator(v->after);
+    }
+    pair<iterator, iterator> range(const K & lo, const K & hi) {
+        iterator a = lower_bound(lo);
+        if (hi < lo) return make_pair(a, a);
+        return make_pair(a, lower_bound(hi));
+    }
+    iterator begin() { return iterator(root->after); }
+    iterator end() { return iterator(null); }
+    int size() const { return n; }
+    bool empty() const { return n == 0; }
+private:
+    // The last bottom node with key < k (or key <= k if inclusive).
+    node * bound(const K & k, bool inclusive) {
+        node * v = highest_root;
+        node * u = highest_null;
+        HT_STAT(int c = 0;)
+        while (v->below != NULL) {
+            v = v->below;
+            u = u->below;
+            while (v->after != u && (HT_STAT(++c,) inclusive ? !(k < v->after->ent._key)
+                                                            : v->after->ent._key < k))
+                v = v->after;
+        }
+        HT_STAT(st.search(c);)
+        return v;
+    }
+    iterator finder(const K & k) {
+        node * v = highest_root;
+        node * u = highest_null;
+        HT_STAT(int c = 0;)
+        while (v->below != NULL) {
+            v = v->below;
+            u = u->below;
+            while (v->after != u && (HT_STAT(++c,) k >= v->after->ent._key))
+                v = v->after;
+        }
+        HT_STAT(st.search(c);)
+        return iterator(v);
+    }
+    iterator inserter(const iterator & p, const K & k, const V & v) {
+        node * u = p.p;
+        node * t = NULL;
+        node * r = root;
+        node * w = null;
+        iterator ret;
+        int h = 0;
+        do {
+            if (h > height_max(n + 1)) break;
+            h++;
+            node * tt = t;
+            if (h == 1) {
+                t = insert_after(u, k, v);
+                ret = iterator(t);
+            } else t = insert_after(u, k, V());
+            if (tt != NULL) {
+                t->below = tt;
+                tt->above = t;
+            }
+            while (u != r && u->above == NULL)
+                u = u->before;
+            if (u->above == NULL)
+                add_row();
+            u = u->above;
+            r = r->above;
+            w = w->above;
+        } while (rand() % 2);
+        n++;
+        return ret;
+    }
+    void add_row() {
+        node * tr = new node;
+        tr->height = highest_root->height + 1;
+        tr->below = highest_root;
+        highest_root->above = tr;
+        node * tn = new node;
+        tn->below = highest_null;
+        highest_null->above = tn;
+        tn->height = tr->height;
+        tr->after = tn;
+        tn->before = tr;
+        highest_root = tr;
+        highest_null = tn;
+    }
+    node * insert_after(node * u, const K & k, const V & v) {
+        node * p = u;
+        node * t = new node;
+        t->ent._key = k;
+        t->ent._value = v;
+        t->before = p;
+        t->after = p->after;
+        t->height = p->height;
+        p->after->before = t;
+        p->after = t;
+        return t;
+    }
+    void create() {
+        root = new node;
+        null = new node;
+        root->after = null;
+        null->before = root;
+        highest_root = root;
+        highest_null = null;
+        srand(time(NULL));
+    }
+    void destroy() {
+        node * p = root;
+        while (p != NULL) {
+            node * u = p->above;
             while (p != NULL) {
                 node * v = p->after;
                 delete p;
@@ -417,6 +2359,26 @@ private:
     }
     int height_max(int i) const
     { return 3 * int(ceil(log(i) / log(2))); }
+#ifdef HASH_TABLE_STATS
+public:
+    hash_table_stats stats() const {
+        hash_table_stats s = st;
+        vector<long long> cnt;
+        for (node * r = root; r != NULL; r = r->above) {
+            long long c = 0;
+            for (node * u = r->after; u != NULL && u->after != NULL; u = u->after)
+                c++;
+            cnt.push_back(c);
+        }
+        s.levels.assign(cnt.size() + 1, 0);
+        for (int h = 1; h <= (int) cnt.size(); h++)
+            s.levels[h] = cnt[h - 1] - (h < (int) cnt.size() ? cnt[h] : 0);
+        return s;
+    }
+    void reset_stats() { st = hash_table_stats(); }
+private:
+    hash_table_stats st;
+#endif
 private:
     node * highest_root;
     node * highest_null;
@@ -425,4 +2387,490 @@ private:
     int n;
 };
 
+/**
+ * Compact Skip List
+ * Every key is a single allocation (a tower) holding the entry, its height
+ * and height forward pointers, instead of one node with four links and a
+ * copy of the entry per level. Towers are carved from 64 KB slabs and kept
+ * on one free list per height, so insert and erase never call malloc once
+ * the slabs are warm, and a search follows one pointer per step.
+ */
+template <typename K, typename V>
+class compact_skip_list {
+private:
+    enum { MAX_LEVEL = 32, SLAB = 1 << 16 };
+    struct node {
+        entry<K, V> ent;
+        int height;
+        node * next[1];
+    };
+public:
+    class iterator {
+    public:
+        iterator(node * _p = NULL) : p(_p) { }
+        entry<K, V> & operator*() { return p->ent; }
+        entry<K, V> & operator*() const { return p->ent; }
+        entry<K, V> * operator->() { return &p->ent; }
+        entry<K, V> * operator->() const { return &p->ent; }
+        bool operator==(const iterator & v) const
+        { return p == v.p; }
+        bool operator!=(const iterator & v) const
+        { return p != v.p; }
+        iterator & operator++() {
+            p = p->next[0];
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+        friend class compact_skip_list<K, V>;
+    private:
+        node * p;
+    };
+public:
+    compact_skip_list() : n(0), level(1), seed(time(NULL) | 1), top(NULL), left(0) {
+        memset(free_towers, 0, sizeof(free_towers));
+        head = allocate(MAX_LEVEL);
+        for (int i = 0; i < MAX_LEVEL; i++)
+            head->next[i] = NULL;
+    }
+    compact_skip_list(const compact_skip_list<K, V> &) = delete;
+    compact_skip_list<K, V> & operator=(const compact_skip_list<K, V> &) = delete;
+    ~compact_skip_list() {
+        for (node * u = head; u != NULL; u = u->next[0])
+            u->ent.~entry<K, V>();
+        for (int i = 0; i < (int) slabs.size(); i++)
+            ::operator delete(slabs[i]);
+    }
+    V & operator[](const K & k) {
+        node * update[MAX_LEVEL];
+        node * u = finder(k, update);
+        if (u == NULL || u->ent._key != k)
+            u = inserter(update, k, V());
+        return u->ent._value;
+    }
+    iterator find(const K & k) {
+        node * update[MAX_LEVEL];
+        node * u = finder(k, update);
+        if (u == NULL || u->ent._key != k) return end();
+        return iterator(u);
+    }
+    iterator insert(const K & k, const V & v) {
+        node * update[MAX_LEVEL];
+        node * u = finder(k, update);
+        if (u != NULL && u->ent._key == k) return end();
+        return iterator(inserter(update, k, v));
+    }
+    void erase(const iterator & p)
+    { erase(p->key()); }
+    void erase(const K & k) {
+        node * update[MAX_LEVEL];
+        node * u = finder(k, update);
+        if (u == NULL || u->ent._key != k) return;
+        for (int i = 0; i < u->height; i++)
+            update[i]->next[i] = u->next[i];
+        while (level > 1 && head->next[level - 1] == NULL)
+            level--;
+        deallocate(u);
+        n--;
+    }
+    void clear() {
+        node * u = head->next[0];
+        while (u != NULL) {
+            node * v = u->next[0];
+            deallocate(u);
+            u = v;
+        }
+        for (int i = 0; i < MAX_LEVEL; i++)
+            head->next[i] = NULL;
+        level = 1;
+        n = 0;
+    }
+    iterator begin() { return iterator(head->next[0]); }
+    iterator end() { return iterator(NULL); }
+    int size() const { return n; }
+    bool empty() const { return n == 0; }
+private:
+    // The first tower whose key is not less than k; update[i] is the last
+    // tower before it on level i.
+    node * finder(const K & k, node ** update) const {
+        node * u = head;
+        for (int i = level - 1; i >= 0; i--) {
+            while (u->next[i] != NULL && u->next[i]->ent._key < k)
+                u = u->next[i];
+            update[i] = u;
+        }
+        return u->next[0];
+    }
+    node * inserter(node ** update, const K & k, const V & v) {
+        int h = random_height();
+        for ( ; level < h; level++)
+            update[level] = head;
+        node * u = allocate(h);
+        u->ent._key = k;
+        u->ent._value = v;
+        for (int i = 0; i < h; i++) {
+            u->next[i] = update[i]->next[i];
+            update[i]->next[i] = u;
+        }
+        n++;
+        return u;
+    }
+    int random_height() {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return 1 + __builtin_ctzll(seed | (1ULL << (MAX_LEVEL - 1)));
+    }
+    static size_t tower_size(int h) {
+        size_t s = sizeof(node) + sizeof(node *) * (h - 1);
+        return (s + alignof(node) - 1) / alignof(node) * alignof(node);
+    }
+    node * allocate(int h) {
+        node * u = free_towers[h];
+        if (u != NULL)
+            free_towers[h] = u->next[0];
+        else {
+            size_t s = tower_size(h);
+            if (left < s) {
+                top = (char *) ::operator new(SLAB);
+                slabs.push_back(top);
+                left = SLAB;
+            }
+            u = (node *) top;
+            top += s;
+            left -= s;
+        }
+        new (&u->ent) entry<K, V>();
+        u->height = h;
+        return u;
+    }
+    void deallocate(node * u) {
+        u->ent.~entry<K, V>();
+        u->next[0] = free_towers[u->height];
+        free_towers[u->height] = u;
+    }
+private:
+    node * head;
+    int n;
+    int level;
+    unsigned long long seed;
+    node * free_towers[MAX_LEVEL + 1];
+    vector<char *> slabs;
+    char * top;
+    size_t left;
+};
+
+/**
+ * Epoch-Based Reclamation
+ * A thread pins the current epoch while it may hold pointers into a
+ * lock-free structure. Objects unlinked from the structure are retired
+ * with the epoch at which they were removed, and freed once the global
+ * epoch has moved two steps past it: the epoch only advances when every
+ * pinned thread has seen the current one, so by then no thread can still
+ * reach them. One domain is shared by the whole process; each thread owns
+ * one of MAX_THREADS slots while it lives. At most MAX_THREADS threads may
+ * use the domain at the same time: the first use by one more thread
+ * aborts the program.
+ */
+class epoch_domain {
+public:
+    enum { MAX_THREADS = 256, BATCH = 64 };
+    static epoch_domain & instance() {
+        static epoch_domain d;
+        return d;
+    }
+    ~epoch_domain() {
+        for (int i = 0; i < MAX_THREADS; i++)
+            for (int j = 0; j < (int) slots[i].retired.size(); j++)
+                slots[i].retired[j].del(slots[i].retired[j].p);
+    }
+    void pin() {
+        slot & s = local();
+        if (s.depth++ == 0)
+            s.epoch.store(global.load() << 1 | 1);
+    }
+    void unpin() {
+        slot & s = local();
+        if (--s.depth == 0)
+            s.epoch.store(0);
+    }
+    void retire(void * p, void (*del)(void *)) {
+        slot & s = local();
+        retired_ptr r = { p, del, global.load() };
+        s.retired.push_back(r);
+        if ((int) s.retired.size() >= BATCH)
+            collect(s);
+    }
+    class guard {
+    public:
+        guard() { instance().pin(); }
+        ~guard() { instance().unpin(); }
+    };
+private:
+    struct retired_ptr {
+        void * p;
+        void (*del)(void *);
+        unsigned long long epoch;
+    };
+    struct alignas(64) slot {
+        atomic<unsigned long long> epoch;
+        atomic<bool> used;
+        int depth;
+        vector<retired_ptr> retired;
+        slot() : epoch(0), used(false), depth(0) { }
+    };
+    struct handle {
+        slot * s;
+        handle() : s(instance().acquire()) { }
+        ~handle() { s->used.store(false); }
+    };
+    epoch_domain() : global(0) { }
+    slot & local() {
+        static thread_local handle h;
+        return *h.s;
+    }
+    slot * acquire() {
+        for (int i = 0; i < MAX_THREADS; i++) {
+            bool expected = false;
+            if (slots[i].used.compare_exchange_strong(expected, true))
+                return &slots[i];
+        }
+        fprintf(stderr, "epoch_domain: more than %d threads\n", (int) MAX_THREADS);
+        abort();
+    }
+    void collect(slot & s) {
+        unsigned long long e = global.load();
+        bool advance = true;
+        for (int i = 0; i < MAX_THREADS && advance; i++) {
+            unsigned long long v = slots[i].epoch.load();
+            if ((v & 1) && (v >> 1) != e) advance = false;
+        }
+        if (advance) global.compare_exchange_strong(e, e + 1);
+        e = global.load();
+        int j = 0;
+        for (int i = 0; i < (int) s.retired.size(); i++)
+            if (s.retired[i].epoch + 2 <= e)
+                s.retired[i].del(s.retired[i].p);
+            else s.retired[j++] = s.retired[i];
+        s.retired.resize(j);
+    }
+private:
+    atomic<unsigned long long> global;
+    slot slots[MAX_THREADS];
+};
+
+/**
+ * Lock-Free Skip List
+ * Towers as in compact_skip_list, with atomic forward pointers. The low bit
+ * of next[i] marks the tower as deleted on level i (Harris / Herlihy &
+ * Shavit): erase marks the levels from the top down, and the thread that
+ * marks level 0 owns the deletion. Any search that meets a marked tower
+ * unlinks it with a CAS on its predecessor. A tower is retired to the
+ * epoch_domain once both its inserter and its eraser are done with it.
+ * Values cannot be changed after insertion. An iterator keeps the epoch
+ * pinned until it reaches end() or is destroyed, so it must stay on the
+ * thread that created it; iteration is weakly consistent.
+ */
+template <typename K, typename V>
+class concurrent_skip_list {
+private:
+    enum { MAX_LEVEL = 24 };
+    struct node {
+        entry<K, V> ent;
+        int height;
+        atomic<int> refs;
+        atomic<uintptr_t> next[1];
+    };
+    static node * ptr(uintptr_t u) { return (node *) (u & ~(uintptr_t) 1); }
+    static bool marked(uintptr_t u) { return u & 1; }
+public:
+    class iterator {
+    public:
+        iterator(node * _p = NULL) : p(_p)
+        { if (p != NULL) epoch_domain::instance().pin(); }
+        iterator(const iterator & u) : p(u.p)
+        { if (p != NULL) epoch_domain::instance().pin(); }
+        ~iterator() { if (p != NULL) epoch_domain::instance().unpin(); }
+        iterator & operator=(const iterator & u) {
+            if (u.p != NULL) epoch_domain::instance().pin();
+            if (p != NULL) epoch_domain::instance().unpin();
+            p = u.p;
+            return *this;
+        }
+        const entry<K, V> & operator*() const { return p->ent; }
+        const entry<K, V> * operator->() const { return &p->ent; }
+        bool operator==(const iterator & v) const
+        { return p == v.p; }
+        bool operator!=(const iterator & v) const
+        { return p != v.p; }
+        iterator & operator++() {
+            node * q = first_alive(p->next[0].load());
+            if (q == NULL) epoch_domain::instance().unpin();
+            p = q;
+            return *this;
+        }
+    private:
+        node * p;
+    };
+public:
+    concurrent_skip_list() : n(0) {
+        head = create(K(), V(), MAX_LEVEL);
+        for (int i = 0; i < MAX_LEVEL; i++)
+            head->next[i].store(0);
+    }
+    concurrent_skip_list(const concurrent_skip_list<K, V> &) = delete;
+    concurrent_skip_list<K, V> & operator=(const concurrent_skip_list<K, V> &) = delete;
+    ~concurrent_skip_list() {
+        node * u = head;
+        while (u != NULL) {
+            node * v = ptr(u->next[0].load());
+            destroy(u);
+            u = v;
+        }
+    }
+    iterator find(const K & k) const {
+        epoch_domain::guard g;
+        node * preds[MAX_LEVEL], * succs[MAX_LEVEL];
+        if (!finder(k, preds, succs)) return end();
+        return iterator(succs[0]);
+    }
+    bool contains(const K & k) const {
+        epoch_domain::guard g;
+        node * preds[MAX_LEVEL], * succs[MAX_LEVEL];
+        return finder(k, preds, succs);
+    }
+    bool insert(const K & k, const V & v) {
+        epoch_domain::guard g;
+        node * preds[MAX_LEVEL], * succs[MAX_LEVEL];
+        int h = random_height();
+        node * u = NULL;
+        while (true) {
+            if (finder(k, preds, succs)) {
+                if (u != NULL) destroy(u);
+                return false;
+            }
+            if (u == NULL) u = create(k, v, h);
+            for (int i = 0; i < h; i++)
+                u->next[i].store((uintptr_t) succs[i]);
+            uintptr_t expected = (uintptr_t) succs[0];
+            if (preds[0]->next[0].compare_exchange_strong(expected, (uintptr_t) u))
+                break;
+        }
+        n++;
+        for (int i = 1; i < h; i++) {
+            while (true) {
+                uintptr_t s = u->next[i].load();
+                if (marked(s)) goto done;
+                if (ptr(s) != succs[i] &&
+                    !u->next[i].compare_exchange_strong(s, (uintptr_t) succs[i]))
+                    continue;
+                uintptr_t expected = (uintptr_t) succs[i];
+                if (preds[i]->next[i].compare_exchange_strong(expected, (uintptr_t) u))
+                    break;
+                finder(k, preds, succs);
+                if (succs[0] != u) goto done;
+            }
+        }
+    done:
+        // An eraser may have cleaned up before the upper levels were linked.
+        if (marked(u->next[0].load()))
+            finder(k, preds, succs);
+        release(u);
+        return true;
+    }
+    bool erase(const K & k) {
+        epoch_domain::guard g;
+        node * preds[MAX_LEVEL], * succs[MAX_LEVEL];
+        if (!finder(k, preds, succs)) return false;
+        node * u = succs[0];
+        for (int i = u->height - 1; i > 0; i--) {
+            uintptr_t s = u->next[i].load();
+            while (!marked(s))
+                u->next[i].compare_exchange_weak(s, s | 1);
+        }
+        uintptr_t s = u->next[0].load();
+        while (true) {
+            if (marked(s)) return false;
+            if (u->next[0].compare_exchange_weak(s, s | 1)) break;
+        }
+        n--;
+        finder(k, preds, succs);
+        release(u);
+        return true;
+    }
+    iterator begin() const {
+        epoch_domain::guard g;
+        return iterator(first_alive(head->next[0].load()));
+    }
+    iterator end() const { return iterator(NULL); }
+    int size() const { return n.load(); }
+    bool empty() const { return n.load() == 0; }
+private:
+    // preds[i] / succs[i]: the towers around k on level i. Marked towers met
+    // on the way are unlinked; a failed unlink restarts the search.
+    bool finder(const K & k, node ** preds, node ** succs) const {
+    retry:
+        node * pred = head;
+        for (int i = MAX_LEVEL - 1; i >= 0; i--) {
+            node * curr = ptr(pred->next[i].load());
+            while (curr != NULL) {
+                uintptr_t succ = curr->next[i].load();
+                while (marked(succ)) {
+                    uintptr_t expected = (uintptr_t) curr;
+                    if (!pred->next[i].compare_exchange_strong(expected, succ & ~(uintptr_t) 1))
+                        goto retry;
+                    curr = ptr(succ);
+                    if (curr == NULL) break;
+                    succ = curr->next[i].load();
+                }
+                if (curr == NULL || !(curr->ent.key() < k)) break;
+                pred = curr;
+                curr = ptr(succ);
+            }
+            preds[i] = pred;
+            succs[i] = curr;
+        }
+        return succs[0] != NULL && !(k < succs[0]->ent.key());
+    }
+    static node * first_alive(uintptr_t u) {
+        node * q = ptr(u);
+        while (q != NULL && marked(q->next[0].load()))
+            q = ptr(q->next[0].load());
+        return q;
+    }
+    static int random_height() {
+        static thread_local unsigned long long seed =
+            (unsigned long long) time(NULL) ^ (uintptr_t) &seed ^ 0x9E3779B97F4A7C15ULL;
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return 1 + __builtin_ctzll(seed | (1ULL << (MAX_LEVEL - 1)));
+    }
+    static node * create(const K & k, const V & v, int h) {
+        node * u = (node *) ::operator new(sizeof(node) + sizeof(atomic<uintptr_t>) * (h - 1));
+        new (&u->ent) entry<K, V>(k, v);
+        u->height = h;
+        new (&u->refs) atomic<int>(2);
+        for (int i = 0; i < h; i++)
+            new (&u->next[i]) atomic<uintptr_t>(0);
+        return u;
+    }
+    static void destroy(void * p) {
+        node * u = (node *) p;
+        u->ent.~entry<K, V>();
+        ::operator delete(u);
+    }
+    // Called by the inserter and by the eraser; the last one retires u.
+    static void release(node * u) {
+        if (u->refs.fetch_sub(1) == 1)
+            epoch_domain::instance().retire(u, destroy);
+    }
+private:
+    node * head;
+    atomic<int> n;
+};
+
 #endif // _HASH_TABLE_H
@@ -4,6 +4,10 @@
 #include <iostream>
 #include <vector>
 #include <functional>
+#include <algorithm>
+#include <utility>
+#include <new>
+#include <type_traits>
 using namespace std;
 
 template <typename T, typename CMP = less<T> >
@@ -56,6 +60,113 @@ public:
     }
 };
 
+/**
+ * Indexed d-ary Heap
+ * Holds ids 0, 1, 2, ... each with a key, at most once each. A position map
+ * from ids to slots lets decrease_key, increase_key and erase find an id
+ * in O(1), so a heap used by Dijkstra or Prim never holds more than V
+ * entries. A larger D makes the heap shallower: push and decrease_key get
+ * cheaper, pop looks at more children per level.
+ */
+template <typename T, int D = 4, typename CMP = less<T> >
+class indexed_heap {
+    static_assert(D >= 2, "D must be at least 2");
+private:
+    int n;
+    vector<int> array;
+    vector<int> pos;
+    vector<T> keys;
+    CMP cmp;
+    void place(int hole, int id) {
+        array[hole] = id;
+        pos[id] = hole;
+    }
+    void up(int hole) {
+        int id = array[hole];
+        for (int parent; hole > 0; hole = parent) {
+            parent = (hole - 1) / D;
+            if (cmp(keys[id], keys[array[parent]]))
+                place(hole, array[parent]);
+            else break;
+        }
+        place(hole, id);
+    }
+    void down(int hole) {
+        int id = array[hole];
+        for (int child; (child = hole * D + 1) < n; hole = child)
+        {
+            int last = min(child + D, n);
+            for (int i = child + 1; i < last; ++i)
+                if (cmp(keys[array[i]], keys[array[child]]))
+                    child = i;
+            if (cmp(keys[array[child]], keys[id]))
+                place(hole, array[child]);
+            else break;
+        }
+        place(hole, id);
+    }
+    void reserve(int id) {
+        if (id < (int) pos.size()) return;
+        int size = max(id + 1, (int) pos.size() << 1);
+        array.resize(size);
+        pos.resize(size, -1);
+        keys.resize(size);
+    }
+public:
+    explicit indexed_heap(int capacity = 100)
+    : n(0), array(capacity), pos(capacity, -1), keys(capacity) { }
+    bool empty() const { return n == 0; }
+    int size() const { return n; }
+    bool contains(int id) const { return id >= 0 && id < (int) pos.size() && pos[id] >= 0; }
+    /** The id with the smallest key */
+    int top() const { return array[0]; }
+    const T & top_key() const { return keys[array[0]]; }
+    const T & key(int id) const { return keys[id]; }
+    /** Inserts id, or sets its key if it is already in the heap. */
+    void push(int id, const T & x) {
+        if (contains(id)) {
+            if (cmp(x, keys[id])) decrease_key(id, x);
+            else increase_key(id, x);
+            return;
+        }
+        reserve(id);
+        keys[id] = x;
+        place(n, id);
+        up(n++);
+    }
+    void pop() {
+        if (empty()) return;
+        erase(array[0]);
+    }
+    /** Does nothing if id is not in the heap or x is greater than its key. */
+    void decrease_key(int id, const T & x) {
+        if (!contains(id) || cmp(keys[id], x)) return;
+        keys[id] = x;
+        up(pos[id]);
+    }
+    /** Does nothing if id is not in the heap or x is less than its key. */
+    void increase_key(int id, const T & x) {
+        if (!contains(id) || cmp(x, keys[id])) return;
+        keys[id] = x;
+        down(pos[id]);
+    }
+    void erase(int id) {
+        if (!contains(id)) return;
+        int hole = pos[id], last = array[--n];
+        pos[id] = -1;
+        if (hole == n) return;
+        place(hole, last);
+        if (hole > 0 && cmp(keys[last], keys[array[(hole - 1) / D]]))
+            up(hole);
+        else down(hole);
+    }
+    void clear() {
+        for (int i = 0; i < n; ++i)
+            pos[array[i]] = -1;
+        n = 0;
+    }
+};
+
 template <typename T>
 class leftist_heap {
 private:
@@ -134,6 +245,13 @@ private:
     node * root;
 };
 
+/**
+ * Pairing Heap
+ * Nodes are carved from 64 KB blocks owned by the heap and recycled through
+ * a free list, and merge() adopts the blocks of rhs, so a position stays
+ * valid until its element is popped. Destroying, copying and pop() use no
+ * recursion, whatever the shape of the heap.
+ */
 template <typename T>
 class pairing_heap {
 private:
@@ -145,22 +263,35 @@ private:
         node(const T & e)
         : element(e), left(NULL), next(NULL), prev(NULL) { }
     };
+    union slot {
+        slot * next;
+        alignas(node) unsigned char bytes[sizeof(node)];
+    };
+    enum { BLOCK = 1 << 16 };
 public:
     typedef node * position;
-    pairing_heap() : n(0), root(NULL) { }
+    pairing_heap()
+    : free_list(NULL), cur(NULL), lim(NULL), n(0), root(NULL) { }
     pairing_heap(const pairing_heap<T> & rhs)
-    : n(rhs.n), root(clone(rhs.root)) { }
-    ~pairing_heap() { make_empty(root); }
+    : free_list(NULL), cur(NULL), lim(NULL), n(rhs.n), root(clone(rhs.root)) { }
+    ~pairing_heap() { clear(); }
     pairing_heap<T> & operator=(const pairing_heap<T> & rhs) {
         pairing_heap<T> copy = rhs;
-        swap(*this, copy);
+        swap(copy);
         return *this;
     }
+    void swap(pairing_heap<T> & rhs) {
+        blocks.swap(rhs.blocks);
+        std::swap(free_list, rhs.free_list);
+        std::swap(cur, rhs.cur);
+        std::swap(lim, rhs.lim);
+        std::swap(n, rhs.n);
+        std::swap(root, rhs.root);
+    }
     position push(const T & x) {
         n++;
-        node * t = new node(x);
-        if (root == NULL) root = t;
-        else compare_and_link(root, t);
+        node * t = create(x);
+        root = (root == NULL ? t : link(root, t));
         return t;
     }
     const T & top() const {
@@ -172,7 +303,7 @@ public:
         node * old = root;
         if (root->left == NULL) root = NULL;
         else root = combine_siblings(root->left);
-        delete old;
+        destroy(old);
     }
     void decrease_key(position p, const T & new_val) {
         if (p->element < new_val) return;
@@ -184,82 +315,142 @@ public:
                 p->prev->left = p->next;
             else p->prev->next = p->next;
             p->next = NULL;
-            compare_and_link(root, p);
+            root = link(root, p);
         }
     }
+    // O(number of free nodes of rhs); the unused rest of its last block is
+    // given up until clear().
     void merge(pairing_heap<T> & rhs) {
-        compare_and_link(root, rhs.root);
+        if (rhs.root != NULL)
+            root = (root == NULL ? rhs.root : link(root, rhs.root));
         n += rhs.n;
+        blocks.insert(blocks.end(), rhs.blocks.begin(), rhs.blocks.end());
+        if (rhs.free_list != NULL) {
+            slot * s = rhs.free_list;
+            while (s->next != NULL) s = s->next;
+            s->next = free_list;
+            free_list = rhs.free_list;
+        }
+        rhs.blocks.clear();
+        rhs.free_list = rhs.cur = rhs.lim = NULL;
         rhs.root = NULL;
         rhs.n = 0;
     }
     bool empty() const { return n == 0; }
-    void clear() { make_empty(root); n = 0; }
+    int size() const { return n; }
+    void clear() {
+        if (!is_trivially_destructible<T>::value)
+            make_empty(root);
+        for (size_t i = 0; i < blocks.size(); i++)
+            ::operator delete(blocks[i]);
+        blocks.clear();
+        free_list = cur = lim = NULL;
+        root = NULL;
+        n = 0;
+    }
 private:
-    void compare_and_link(node * & first, node * second) {
-        if (second == NULL) return;
-        if (second->element < first->element) {
-            second->prev = first->prev;
-            first->prev = second;
-            first->next = second->left;
-            if (first->next != NULL)
-                first->next->prev = first;
-            second->left = first;
-            first = second;
-        } else {
-            second->prev = first;
-            first->next = second->next;
-            if (first->next != NULL)
-                first->next->prev = first;
-            second->next = first->left;
-            if (second->next != NULL)
-                second->next->prev = second;
-            first->left = second;
+    node * create(const T & x) {
+        slot * s = free_list;
+        if (s != NULL)
+            free_list = s->next;
+        else {
+            if (cur == lim) {
+                size_t m = max((size_t) 16, BLOCK / sizeof(slot));
+                cur = (slot *) ::operator new(m * sizeof(slot));
+                lim = cur + m;
+                blocks.push_back(cur);
+            }
+            s = cur++;
         }
+        return new (s->bytes) node(x);
+    }
+    void destroy(node * p) {
+        p->~node();
+        slot * s = (slot *) p;
+        s->next = free_list;
+        free_list = s;
+    }
+    // Links two trees without siblings and returns the new root.
+    node * link(node * first, node * second) {
+        if (second->element < first->element)
+            std::swap(first, second);
+        second->prev = first;
+        second->next = first->left;
+        if (second->next != NULL)
+            second->next->prev = second;
+        first->left = second;
+        return first;
     }
+    // Two passes: link the siblings in pairs from left to right, keeping
+    // the results on a stack threaded through next, then link them from
+    // right to left.
     node * combine_siblings(node * first_sibling) {
-        if (first_sibling->next == NULL)
-            return first_sibling;
-        static vector<node *> tree_arr(5);
-        int num_siblings = 0;
-        for ( ; first_sibling != NULL; ++num_siblings) {
-            if (num_siblings == tree_arr.size())
-                tree_arr.resize(num_siblings * 2);
-            tree_arr[num_siblings] = first_sibling;
-            first_sibling->prev->next = NULL;
-            first_sibling = first_sibling->next;
+        node * stack = NULL;
+        while (first_sibling != NULL) {
+            node * a = first_sibling, * b = a->next;
+            first_sibling = (b == NULL ? NULL : b->next);
+            a->next = NULL;
+            if (b != NULL) {
+                b->next = NULL;
+                a = link(a, b);
+            }
+            a->next = stack;
+            stack = a;
         }
-        if (num_siblings == tree_arr.size())
-            tree_arr.resize(num_siblings + 1);
-        tree_arr[num_siblings] = NULL;
-        int i = 0;
-        for ( ; i + 1 < num_siblings; i += 2)
-            compare_and_link(tree_arr[i], tree_arr[i + 1]);
-        int j = i - 2;
-        if (j == num_siblings - 3)
-            compare_and_link(tree_arr[j], tree_arr[j + 2]);
-        for ( ; j >= 2; j -= 2)
-            compare_and_link(tree_arr[j - 2], tree_arr[j]);
-        return tree_arr[0];
+        node * t = stack;
+        stack = stack->next;
+        t->next = NULL;
+        while (stack != NULL) {
+            node * s = stack;
+            stack = s->next;
+            s->next = NULL;
+            t = link(t, s);
+        }
+        t->prev = NULL;
+        return t;
     }
-    void make_empty(node * & t) {
-        if (t != NULL) {
-            make_empty(t->left);
-            make_empty(t->next);
-            delete t;
-            t = NULL;
+    // Reading left as the left child and next as the right one, a right
+    // rotation at t moves one node out of the left spine, so the loop
+    // takes O(n) steps and no stack.
+    void make_empty(node * t) {
+        while (t != NULL) {
+            if (t->left != NULL) {
+                node * l = t->left;
+                t->left = l->next;
+                l->next = t;
+                t = l;
+            } else {
+                node * next = t->next;
+                t->~node();
+                t = next;
+            }
         }
     }
     node * clone(node * t) {
         if (t == NULL) return NULL;
-        node * p = new node(t->element);
-        if ((p->left = clone(t->left)) != NULL)
-            p->left->prev = p;
-        if ((p->next = clone(t->next)) != NULL)
-            p->next->prev = p;
-        return p;
+        node * r = create(t->element);
+        vector<pair<node *, node *> > todo(1, make_pair(t, r));
+        while (!todo.empty()) {
+            node * from = todo.back().first, * to = todo.back().second;
+            todo.pop_back();
+            if (from->left != NULL) {
+                to->left = create(from->left->element);
+                to->left->prev = to;
+                todo.push_back(make_pair(from->left, to->left));
+            }
+            if (from->next != NULL) {
+                to->next = create(from->next->element);
+                to->next->prev = to;
+                todo.push_back(make_pair(from->next, to->next));
+            }
+        }
+        return r;
     }
 private:
+    vector<slot *> blocks;
+    slot * free_list;
+    slot * cur;
+    slot * lim;
     int n;
     node * root;
 };
@@ -7,10 +7,163 @@
 #include <cstdlib>
 #include <ctime>
 #include <climits>
+#include <new>
+#include <vector>
+#include <type_traits>
+#include <future>
+#include <thread>
+#include <atomic>
 using namespace std;
 
-template <typename K, typename V>
+/**
+ * Node Allocation Policies
+ * Every tree gets its nodes from a member A<node>: create() returns a new
+ * default-constructed node and destroy(p) takes it back. release() frees
+ * all nodes at once and returns true, or returns false if the policy can
+ * only free nodes one at a time. Trees call it from clear() and their
+ * destructors when the nodes need no destructor, and otherwise destroy the
+ * nodes one by one. splice(o) takes over all nodes of the pool o, so a
+ * tree can adopt the nodes of another one.
+ * slab_pool: nodes are carved from 64 KB slabs owned by the tree and
+ * recycled through a free list, so insert/erase churn does not reach
+ * malloc once the slabs are warm, and a tree's nodes stay close together.
+ * heap_allocator: one new and one delete per node.
+ */
+template <typename T>
+class slab_pool {
+private:
+    union slot {
+        slot * next;
+        alignas(T) unsigned char bytes[sizeof(T)];
+    };
+    enum { SLAB = 1 << 16 };
+    vector<slot *> slabs;
+    slot * free_list;
+    slot * cur;
+    slot * lim;
+public:
+    slab_pool() : free_list(NULL), cur(NULL), lim(NULL) { }
+    slab_pool(const slab_pool<T> &) = delete;
+    slab_pool<T> & operator=(const slab_pool<T> &) = delete;
+    ~slab_pool() { release(); }
+    T * create() {
+        slot * s = free_list;
+        if (s != NULL)
+            free_list = s->next;
+        else {
+            if (cur == lim) grow();
+            s = cur++;
+        }
+        return new (s->bytes) T;
+    }
+    void destroy(T * p) {
+        p->~T();
+        slot * s = (slot *) p;
+        s->next = free_list;
+        free_list = s;
+    }
+    // O(number of free slots of o); the unused rest of its last slab is
+    // given up until release().
+    void splice(slab_pool<T> & o) {
+        slabs.insert(slabs.end(), o.slabs.begin(), o.slabs.end());
+        o.slabs.clear();
+        if (o.free_list != NULL) {
+            slot * s = o.free_list;
+            while (s->next != NULL) s = s->next;
+            s->next = free_list;
+            free_list = o.free_list;
+        }
+        o.free_list = o.cur = o.lim = NULL;
+    }
+    bool release() {
+        for (size_t i = 0; i < slabs.size(); i++)
+            ::operator delete(slabs[i]);
+        slabs.clear();
+        free_list = cur = lim = NULL;
+        return true;
+    }
+private:
+    void grow() {
+        size_t m = max((size_t) 16, SLAB / sizeof(slot));
+        cur = (slot *) ::operator new(m * sizeof(slot));
+        lim = cur + m;
+        slabs.push_back(cur);
+    }
+};
+template <typename T>
+struct heap_allocator {
+    T * create() { return new T; }
+    void destroy(T * p) { delete p; }
+    void splice(heap_allocator<T> &) { }
+    bool release() { return false; }
+};
+
+/**
+ * Node Update Policies
+ * The last template parameter of search_tree, splay_tree, avl_tree and
+ * rb_tree decides what a node keeps about its subtree. Every node derives
+ * from U::data; the trees call U::pull(u) when the children of u change
+ * and U::add(p, h, d) when a node is added (d = 1) or removed (d = -1)
+ * below p, h being the header above the root.
+ * null_node_update: nothing, at no cost.
+ * order_statistics_node_update: subtree sizes, for rank queries in
+ * O(height). The trees (and treap, which always keeps sizes) forward
+ * find_by_order(k), the entry with k keys before it or end(), to select,
+ * and order_of_key(k), the number of keys less than k, to rank.
+ */
+struct null_node_update {
+    struct data { };
+    template <typename N>
+    static void pull(N *) { }
+    template <typename N>
+    static void add(N *, N *, int) { }
+};
+struct order_statistics_node_update {
+    struct data {
+        int size;
+        data() : size(0) { }
+    };
+    template <typename N>
+    static void pull(N * u) { u->size = u->left->size + u->right->size + 1; }
+    template <typename N>
+    static void add(N * p, N * h, int d) {
+        for (; p != h; p = p->par) p->size += d;
+    }
+    // The node with k nodes before it below v, which must have more than
+    // k nodes. External nodes are the ones without children.
+    template <typename N>
+    static N * select(N * v, int k) {
+        while (k != v->left->size)
+            if (k < v->left->size) v = v->left;
+            else {
+                k -= v->left->size + 1;
+                v = v->right;
+            }
+        return v;
+    }
+    // The number of keys less than k below v; *last is set to the last
+    // internal node visited, if any.
+    template <typename N, typename K>
+    static int rank(N * v, const K & k, N ** last = NULL) {
+        int r = 0;
+        while (v->left != NULL) {
+            if (last != NULL) *last = v;
+            if (v->ent.key() < k) {
+                r += v->left->size + 1;
+                v = v->right;
+            } else v = v->left;
+        }
+        return r;
+    }
+};
+
+template <typename K, typename V, template <typename> class A = slab_pool,
+          typename U = null_node_update>
 class search_tree;
+template <typename K, typename V, template <typename> class A = slab_pool>
+class b_tree;
+template <typename K, typename V>
+class persistent_avl_tree;
 template <typename K, typename V>
 class entry {
 private:
@@ -23,12 +176,17 @@ public:
     const K & key() const { return _key; }
     const V & value() const { return _value; }
     void set_value(const V & v) { _value = v; }
-    friend class search_tree<K, V>;
+    template <typename K1, typename V1, template <typename> class A, typename U>
+    friend class search_tree;
+    template <typename K1, typename V1, template <typename> class A>
+    friend class b_tree;
+    template <typename K1, typename V1>
+    friend class persistent_avl_tree;
 };
-template <typename K, typename V>
+template <typename K, typename V, template <typename> class A, typename U>
 class search_tree {
 private:
-    struct node {
+    struct node : public U::data {
         entry<K, V> ent;
         node * par;
         node * left;
@@ -74,27 +232,26 @@ public:
             ++*this;
             return i;
         }
-        friend class search_tree<K, V>;
+        friend class search_tree<K, V, A, U>;
     };
 public:
     search_tree() : _root(NULL), n(0)
     { add_root(); expand_external(_root); }
-    search_tree(const search_tree<K, V> & st)
+    search_tree(const search_tree<K, V, A, U> & st)
                : _root(clone(st._root, NULL)), n(st.n) { }
-    ~search_tree() { clear(); make_empty(_root); }
-    search_tree<K, V> & operator=(const search_tree<K, V> & st) {
-        clear();
-        make_empty(_root);
+    ~search_tree() { destroy_all(); }
+    search_tree<K, V, A, U> & operator=(const search_tree<K, V, A, U> & st) {
+        if (this == &st) return *this;
+        destroy_all();
         _root = clone(st._root, NULL);
         n = st.n;
         return *this;
     }
     void clear() {
-        /*n = 0;
-        make_empty(_root->left->left);
-        make_empty(_root->left->right);*/
-        while (!empty())
-            eraser(root());
+        destroy_all();
+        n = 0;
+        add_root();
+        expand_external(_root);
     }
     iterator find(const K & k) {
         iterator v = finder(k, root());
@@ -105,6 +262,7 @@ public:
         iterator v = finder(k, root());
         if (v.is_external()) {
             expand_external(v);
+            U::add(v.p, _root, 1);
             v->set_key(k);
             n++;
         }
@@ -118,6 +276,9 @@ public:
     }
     void erase(const iterator & p)
     { eraser(p); }
+    iterator find_by_order(int k)
+    { return k < 0 || k >= n ? end() : iterator(U::select(_root->left, k)); }
+    int order_of_key(const K & k) { return U::rank(_root->left, k); }
     iterator begin() {
         iterator v = root();
         while (v.is_internal()) v = v.left();
@@ -128,12 +289,12 @@ public:
     bool empty() const { return n == 0; }
     iterator root() const { return iterator(_root->left); }
 private:
-    void add_root() { _root = new node; }
+    void add_root() { _root = pool.create(); }
     void expand_external(const iterator & p) {
         node * v = p.p;
-        v->left = new node;
+        v->left = pool.create();
         v->left->par = v;
-        v->right = new node;
+        v->right = pool.create();
         v->right->par = v;
     }
     iterator remove_above_external(const iterator & p) {
@@ -148,7 +309,7 @@ private:
             else gpar->right = sib;
             sib->par = gpar;
         }
-        delete w; delete v;
+        pool.destroy(w); pool.destroy(v);
         return iterator(sib);
     }
     iterator finder(const K & k, const iterator & v) {
@@ -169,6 +330,7 @@ private:
         iterator v = finder(k, root());
         if (v.is_internal()) return end();
         expand_external(v);
+        U::add(v.p, _root, 1);
         v->set_key(k); v->set_value(x);
         n++;
         return v;
@@ -184,31 +346,43 @@ private:
             v->set_key(u->key()); v->set_value(u->value());
         }
         n--;
-        return remove_above_external(w);
+        iterator s = remove_above_external(w);
+        U::add(s.p->par, _root, -1);
+        return s;
+    }
+    // Frees every node, including the sentinels. Nodes without a
+    // destructor are dropped with their slabs instead of one by one.
+    void destroy_all() {
+        if (!is_trivially_destructible<node>::value || !pool.release())
+            make_empty(_root);
+        _root = NULL;
     }
     void make_empty(node * & p) {
         if (p != NULL) {
             make_empty(p->left);
             make_empty(p->right);
-            delete p;
+            pool.destroy(p);
         }
         p = NULL;
     }
-    node * clone(node * t, node * p) const {
+    node * clone(node * t, node * p) {
         if (t == NULL) return NULL;
-        node * r = new node;
+        node * r = pool.create();
         r->ent = t->ent;
         r->par = p;
         r->left = clone(t->left, r);
         r->right = clone(t->right, r);
+        if (r->left != NULL) U::pull(r);
         return r;
     }
 private:
+    A<node> pool;
     node * _root;
     int n;
 };
 
-template <typename K, typename V>
+template <typename K, typename V, template <typename> class A = slab_pool,
+          typename U = null_node_update>
 class splay_tree;
 template <typename K, typename V>
 class splay_entry {
@@ -222,12 +396,13 @@ public:
     const K & key() const { return _key; }
     const V & value() const { return _value; }
     void set_value(const V & v) { _value = v; }
-    friend class splay_tree<K, V>;
+    template <typename K1, typename V1, template <typename> class A, typename U>
+    friend class splay_tree;
 };
-template <typename K, typename V>
+template <typename K, typename V, template <typename> class A, typename U>
 class splay_tree {
 private:
-    struct node {
+    struct node : public U::data {
         splay_entry<K, V> ent;
         node * left;
         node * right;
@@ -274,25 +449,28 @@ public:
             ++*this;
             return i;
         }
-        friend class splay_tree<K, V>;
+        friend class splay_tree<K, V, A, U>;
     };
 public:
     splay_tree() : _root(NULL), n(0) {
         add_root();
         expand_external(_root);
     }
-    splay_tree(const splay_tree<K, V> & rhs)
+    splay_tree(const splay_tree<K, V, A, U> & rhs)
     : _root(clone(rhs._root, NULL)), n(rhs.n) { }
-    ~splay_tree() { clear(); make_empty(_root); }
-    splay_tree<K, V> & operator=(const splay_tree<K, V> & rhs) {
-        splay_tree<K, V> copy = rhs;
-        swap(*this, copy);
+    ~splay_tree() { destroy_all(); }
+    splay_tree<K, V, A, U> & operator=(const splay_tree<K, V, A, U> & rhs) {
+        if (this == &rhs) return *this;
+        destroy_all();
+        _root = clone(rhs._root, NULL);
+        n = rhs.n;
         return *this;
     }
     V & operator[](const K & k) {
         iterator v = finder(k, root());
         if (v.is_external()) {
             expand_external(v);
+            U::add(v.p, _root, 1);
             v->set_key(k);
             splay(v, iterator(_root));
             n++;
@@ -320,10 +498,23 @@ public:
         splay(v.parent(), iterator(_root));
     }
     void clear() {
-        while (!empty()) {
-            find_max();
-            erase(root());
-        }
+        destroy_all();
+        n = 0;
+        add_root();
+        expand_external(_root);
+    }
+    // The last node visited is splayed.
+    iterator find_by_order(int k) {
+        if (k < 0 || k >= n) return end();
+        node * v = U::select(_root->left, k);
+        splay(iterator(v), iterator(_root));
+        return iterator(v);
+    }
+    int order_of_key(const K & k) {
+        node * w = NULL;
+        int r = U::rank(_root->left, k, &w);
+        if (w != NULL) splay(iterator(w), iterator(_root));
+        return r;
     }
     iterator begin() {
         iterator v = root();
@@ -343,6 +534,7 @@ private:
         return ptr.parent()->key();
     }
     void rotate_with_left_child(const iterator & u) {
+        COUNT_ROTATIONS(1);
         node * k2 = u.p;
         node * k1 = k2->left;
         node * p = k2->par;
@@ -353,8 +545,10 @@ private:
         k2->left->par = k2;
         k1->right = k2;
         k2->par = k1;
+        U::pull(k2); U::pull(k1);
     }
     void rotate_with_right_child(const iterator & u) {
+        COUNT_ROTATIONS(1);
         node * k1 = u.p;
         node * k2 = k1->right;
         node * p = k1->par;
@@ -365,6 +559,7 @@ private:
         k1->right->par = k1;
         k2->left = k1;
         k1->par = k2;
+        U::pull(k1); U::pull(k2);
     }
     void splay(const iterator & u, const iterator & r) {
         if (u == r) return;
@@ -393,12 +588,12 @@ private:
         }
     }
 private:
-    void add_root() { _root = new node; }
+    void add_root() { _root = pool.create(); }
     void expand_external(const iterator & p) {
         node * v = p.p;
-        v->left = new node;
+        v->left = pool.create();
         v->left->par = v;
-        v->right = new node;
+        v->right = pool.create();
         v->right->par = v;
     }
     iterator remove_above_external(const iterator & p) {
@@ -413,7 +608,7 @@ private:
             else gpar->right = sib;
             sib->par = gpar;
         }
-        delete w; delete v;
+        pool.destroy(w); pool.destroy(v);
         return iterator(sib);
     }
     iterator finder(const K & k, const iterator & v) {
@@ -430,6 +625,7 @@ private:
         iterator v = finder(k, root());
         if (v.is_internal()) return end();
         expand_external(v);
+        U::add(v.p, _root, 1);
         v->set_key(k); v->set_value(x);
         n++;
         return v;
@@ -445,31 +641,40 @@ private:
             v->set_key(u->key()); v->set_value(u->value());
         }
         n--;
-        return remove_above_external(w);
+        iterator s = remove_above_external(w);
+        U::add(s.p->par, _root, -1);
+        return s;
+    }
+    void destroy_all() {
+        if (!is_trivially_destructible<node>::value || !pool.release())
+            make_empty(_root);
+        _root = NULL;
     }
     void make_empty(node * & p) {
         if (p != NULL) {
             make_empty(p->left);
             make_empty(p->right);
-            delete p;
+            pool.destroy(p);
         }
         p = NULL;
     }
-    node * clone(node * t, node * p) const {
+    node * clone(node * t, node * p) {
         if (t == NULL) return NULL;
-        node * r = new node;
+        node * r = pool.create();
         r->ent = t->ent;
         r->par = p;
         r->left = clone(t->left, r);
         r->right = clone(t->right, r);
+        if (r->left != NULL) U::pull(r);
         return r;
     }
 private:
+    A<node> pool;
     node * _root;
     int n;
 };
 
-template <typename K, typename V>
+template <typename K, typename V, template <typename> class A = slab_pool>
 class treap;
 template <typename K, typename V>
 class treap_entry {
@@ -486,9 +691,10 @@ public:
     const K & key() const { return _key; }
     const V & value() const { return _value; }
     void set_value(const V & v) { _value = v; }
-    friend class treap<K, V>;
+    template <typename K1, typename V1, template <typename> class A>
+    friend class treap;
 };
-template <typename K, typename V>
+template <typename K, typename V, template <typename> class A>
 class treap {
 private:
     struct node {
@@ -496,9 +702,12 @@ private:
         node * left;
         node * right;
         node * par;
+        int size;
         node(const K & k = K(), const V & v = V(), node * lt = NULL, node * rt = NULL, node * p = NULL, int pr = INT_MAX)
-            : ent(k, v, pr), left(lt), right(rt), par(p) { }
+            : ent(k, v, pr), left(lt), right(rt), par(p), size(0) { }
     };
+    typedef node * (treap::*set_op)(node *, node *, int, node * &);
+    enum { GRAIN = 1 << 14 };
 public:
     class iterator {
     private:
@@ -538,184 +747,414 @@ public:
             ++*this;
             return i;
         }
-        friend class treap<K, V>;
+        friend class treap<K, V, A>;
     };
 public:
-    treap() : _root(NULL), n(0) {
+    treap() : nil(sentinel()), _root(NULL), n(0) {
         srand(time(NULL));
         add_root();
-        expand_external(_root);
     }
-    treap(const treap<K, V> & rhs)
-         : _root(clone(rhs._root, NULL)), n(rhs.n) {
+    treap(const treap<K, V, A> & rhs)
+         : nil(sentinel()), _root(clone(rhs._root, NULL)), n(rhs.n) {
         srand(time(NULL));
     }
-    ~treap() { make_empty(_root); }
-    treap<K, V> & operator=(const treap<K, V> & rhs) {
-        make_empty(_root);
+    ~treap() { destroy_all(); }
+    treap<K, V, A> & operator=(const treap<K, V, A> & rhs) {
+        if (this == &rhs) return *this;
+        destroy_all();
         _root = clone(rhs._root, NULL);
         n = rhs.n;
         return *this;
     }
-    V & operator[](const K & k)
-    { return find(k, root()); }
+    V & operator[](const K & k) {
+        bool added = false;
+        return locate(k, _root->left, _root, added)->ent._value;
+    }
     iterator find(const K & k) {
-        iterator v = finder(k, root());
+        iterator v = finder(k);
         if (v.is_internal()) return v;
         else return end();
     }
-    iterator insert(const K & k, const V & v)
-    { return inserter(k, v, root()); }
+    iterator insert(const K & k, const V & v) {
+        bool added = false;
+        node * u = locate(k, _root->left, _root, added);
+        if (!added) return end();
+        u->ent.set_value(v);
+        return u;
+    }
     void erase(const K & k) {
-        iterator v = finder(k, root());
+        iterator v = finder(k);
         if (v.is_internal()) erase(v);
     }
-    void erase(const iterator & p)
-    { eraser(p); }
+    void erase(const iterator & v) {
+        node * u = v.p, * p = u->par;
+        node * c = join(u->left, u->right);
+        if (p->left == u) set_left(p, c);
+        else set_right(p, c);
+        for (; p != _root; p = p->par) p->size--;
+        pool.destroy(u);
+        n--;
+    }
     void clear() {
+        destroy_all();
         n = 0;
-        make_empty(_root->left->left);
-        make_empty(_root->left->right);
+        add_root();
     }
-    /*treap & operator=(const treap & rhs) {
-        treap copy = rhs;
-        swap(*this, copy);
-        return *this;
-    }*/
+    /**
+     * Replaces the contents with the sorted range [first, last) of
+     * (key, value) pairs in O(n). The middle key of each range becomes
+     * its root, and a node at depth d gets a random priority from the d-th
+     * of equal bands of [0, RAND_MAX], which keeps the heap order.
+     * A key not greater than the previous one is skipped.
+     */
+    template <typename I>
+    void build_from_sorted(I first, I last) {
+        clear();
+        vector<node *> v;
+        for (; first != last; ++first) {
+            if (!v.empty() && !(v.back()->ent.key() < first->first)) continue;
+            node * u = pool.create();
+            u->ent.set_key(first->first);
+            u->ent.set_value(first->second);
+            v.push_back(u);
+        }
+        n = v.size();
+        int h = 0;
+        while ((1 << h) - 1 < n) h++;
+        _root->left = build(v, 0, n, _root, 0, RAND_MAX / (h + 1));
+    }
+    /**
+     * Set Operations
+     * Each one takes all nodes of t, which is left empty, and runs in
+     * O(m log(n/m + 1)) expected time for sizes m <= n: the root with the
+     * higher priority splits the other tree, and the two halves are
+     * combined recursively, as parallel tasks near the top of a large
+     * recursion. set_union keeps the values of *this for common keys.
+     * join appends t, whose keys must all be greater than those of *this.
+     */
+    void set_union(treap<K, V, A> & t) { combine(&treap::unite, t); }
+    void set_intersection(treap<K, V, A> & t) { combine(&treap::intersect, t); }
+    void set_difference(treap<K, V, A> & t) { combine(&treap::subtract, t); }
+    void join(treap<K, V, A> & t) { combine(&treap::concat, t); }
+    iterator find_by_order(int k) {
+        if (k < 0 || k >= n) return end();
+        return iterator(order_statistics_node_update::select(_root->left, k));
+    }
+    int order_of_key(const K & k)
+    { return order_statistics_node_update::rank(_root->left, k); }
     iterator begin() {
-        iterator v = root();
-        while (v.is_internal()) v = v.left();
-        return v.parent();
+        node * v = _root;
+        while (v->left != nil) v = v->left;
+        return iterator(v);
     }
     iterator end() { return _root; }
     int size() const { return n; }
     bool empty() const { return n == 0; }
     iterator root() const { return iterator(_root->left); }
 private:
-    iterator finder(const K & k, const iterator & v) {
-        if (v.is_external()) return v;
-        if (k < v->key()) return finder(k, v.left());
-        else if (v->key() < k) return finder(k, v.right());
-        else return v;
-    }
-    V & find(const K & k, const iterator & u) {
-        if (u.is_external()) {
-            expand_external(u);
-            u->set_key(k);
-            u->set_priority(rand());
-            n++;
-            return u->_value;
-        } else if (k < u->key()) {
-            V & r = find(k, u.left());
-            if (u.left()->priority() < u->priority())
-                rotate_with_left_child(u);
-            return r;
-        } else if (u->key() < k) {
-            V & r = find(k, u.right());
-            if (u.right()->priority() < u->priority())
-                rotate_with_right_child(u);
-            return r;
-        } else return u->_value;
-    }
-    iterator inserter(const K & k, const V & v, const iterator & u) {
-        if (u.is_external()) {
-            expand_external(u);
-            u->set_key(k);
-            u->set_value(v);
-            u->set_priority(rand());
+    iterator finder(const K & k) const {
+        node * v = _root->left;
+        while (v != nil)
+            if (k < v->ent.key()) v = v->left;
+            else if (v->ent.key() < k) v = v->right;
+            else break;
+        return iterator(v);
+    }
+    // The node of k in the subtree u, a child of p, which is created if
+    // there is none (and then added is set).
+    node * locate(const K & k, node * & u, node * p, bool & added) {
+        if (u == nil) {
+            u = pool.create();
+            u->ent.set_key(k);
+            u->ent.set_priority(rand());
+            u->left = u->right = nil;
+            u->par = p;
+            u->size = 1;
+            added = true;
             n++;
             return u;
-        } else if (k < u->key()) {
-            iterator r = inserter(k, v, u.left());
-            if (u.left()->priority() < u->priority())
-                rotate_with_left_child(u);
-            return r;
-        } else if (u->key() < k) {
-            iterator r = inserter(k, v, u.right());
-            if (u.right()->priority() < u->priority())
-                rotate_with_right_child(u);
-            return r;
-        } else return end();
-    }
-    iterator eraser(const iterator & v) {
-        iterator w;
-        if (v.left().is_external()) w = v.left();
-        else if (v.right().is_external()) w = v.right();
-        else {
-            w = v.right();
-            do { w = w.left(); } while (w.is_internal());
-            iterator u = w.parent();
-            v->set_key(u->key()); v->set_value(u->value());
         }
-        n--;
-        return remove_above_external(w);
+        node * r = u;
+        if (k < u->ent.key()) {
+            r = locate(k, u->left, u, added);
+            if (added) {
+                u->size++;
+                if (u->left->ent.priority() < u->ent.priority())
+                    rotate_with_left_child(u);
+            }
+        } else if (u->ent.key() < k) {
+            r = locate(k, u->right, u, added);
+            if (added) {
+                u->size++;
+                if (u->right->ent.priority() < u->ent.priority())
+                    rotate_with_right_child(u);
+            }
+        }
+        return r;
     }
-    void rotate_with_left_child(const iterator & u) {
-        node * k2 = u.p;
+    void rotate_with_left_child(node * k2) {
+        COUNT_ROTATIONS(1);
         node * k1 = k2->left;
         node * p = k2->par;
         if (p->left == k2) p->left = k1;
         else p->right = k1;
         k1->par = p;
-        k2->left = k1->right;
-        k2->left->par = k2;
-        k1->right = k2;
-        k2->par = k1;
+        set_left(k2, k1->right);
+        set_right(k1, k2);
+        pull(k2); pull(k1);
     }
-    void rotate_with_right_child(const iterator & u) {
-        node * k1 = u.p;
+    void rotate_with_right_child(node * k1) {
+        COUNT_ROTATIONS(1);
         node * k2 = k1->right;
         node * p = k1->par;
         if (p->left == k1) p->left = k2;
         else p->right = k2;
         k2->par = p;
-        k1->right = k2->left;
-        k1->right->par = k1;
-        k2->left = k1;
-        k1->par = k2;
+        set_right(k1, k2->left);
+        set_left(k2, k1);
+        pull(k1); pull(k2);
     }
 private:
-    void add_root() { _root = new node; }
-    void expand_external(const iterator & p) {
-        node * v = p.p;
-        v->left = new node;
-        v->left->par = v;
-        v->right = new node;
-        v->right->par = v;
+    // The external node shared by all treaps of this type. It is never
+    // written, so trees can exchange subtrees and set operations can run
+    // on several threads.
+    static node * sentinel() {
+        static node s;
+        return &s;
+    }
+    void add_root() {
+        _root = pool.create();
+        _root->left = _root->right = nil;
+    }
+    void set_left(node * u, node * c) {
+        u->left = c;
+        if (c != nil) c->par = u;
+    }
+    void set_right(node * u, node * c) {
+        u->right = c;
+        if (c != nil) c->par = u;
+    }
+    void pull(node * u) { u->size = u->left->size + u->right->size + 1; }
+    // Splits the subtree u into l (keys less than k) and r (keys greater
+    // than k), and returns the node of k, unlinked, or nil.
+    node * split(node * u, const K & k, node * & l, node * & r) {
+        if (u == nil) {
+            l = r = nil;
+            return nil;
+        }
+        node * e, * t;
+        if (k < u->ent.key()) {
+            e = split(u->left, k, l, t);
+            set_left(u, t);
+            pull(u);
+            r = u;
+        } else if (u->ent.key() < k) {
+            e = split(u->right, k, t, r);
+            set_right(u, t);
+            pull(u);
+            l = u;
+        } else {
+            l = u->left;
+            r = u->right;
+            e = u;
+        }
+        return e;
+    }
+    // Joins the subtrees a and b, where every key of a is less than every
+    // key of b.
+    node * join(node * a, node * b) {
+        if (a == nil) return b;
+        if (b == nil) return a;
+        if (a->ent.priority() < b->ent.priority()) {
+            set_right(a, join(a->right, b));
+            pull(a);
+            return a;
+        } else {
+            set_left(b, join(a, b->left));
+            pull(b);
+            return b;
+        }
     }
-    iterator remove_above_external(const iterator & p) {
-        node * w = p.p; node * v = w->par;
-        node * sib = (w == v->left ? v->right : v->left);
-        if (v == _root) {
-            _root = sib;
-            sib->par = NULL;
+    // Nodes left out of a set operation are chained through par into g
+    // and destroyed once it is over, since the pool is not thread-safe.
+    void drop(node * u, node * & g) {
+        u->left = u->right = nil;
+        drop_tree(u, g);
+    }
+    void drop_tree(node * u, node * & g) {
+        if (u == nil) return;
+        u->par = g;
+        g = u;
+    }
+    node * unite(node * a, node * b, int par, node * & g) {
+        if (b == nil) return a;
+        if (a == nil) return b;
+        node * l, * r, * x0, * x1, * u, * e;
+        if (a->ent.priority() <= b->ent.priority()) {
+            e = split(b, a->ent.key(), l, r);
+            if (e != nil) drop(e, g);
+            x0 = a->left; x1 = a->right;
+            u = a;
+            fork(&treap::unite, x0, l, x1, r, x0, x1, par, g);
         } else {
-            node * gpar = v->par;
-            if (v == gpar->left) gpar->left = sib;
-            else gpar->right = sib;
-            sib->par = gpar;
+            e = split(a, b->ent.key(), l, r);
+            x0 = b->left; x1 = b->right;
+            u = b;
+            if (e != nil) {
+                e->ent.set_priority(b->ent.priority());
+                drop(b, g);
+                u = e;
+            }
+            fork(&treap::unite, l, x0, r, x1, x0, x1, par, g);
         }
-        delete w; delete v;
-        return iterator(sib);
+        set_left(u, x0);
+        set_right(u, x1);
+        pull(u);
+        return u;
+    }
+    node * intersect(node * a, node * b, int par, node * & g) {
+        if (a == nil || b == nil) {
+            drop_tree(a, g);
+            drop_tree(b, g);
+            return nil;
+        }
+        node * l, * r, * x0, * x1, * u, * e;
+        if (a->ent.priority() <= b->ent.priority()) {
+            e = split(b, a->ent.key(), l, r);
+            x0 = a->left; x1 = a->right;
+            u = a;
+            if (e != nil) drop(e, g);
+            else {
+                drop(a, g);
+                u = nil;
+            }
+            fork(&treap::intersect, x0, l, x1, r, x0, x1, par, g);
+        } else {
+            e = split(a, b->ent.key(), l, r);
+            x0 = b->left; x1 = b->right;
+            u = e;
+            if (e != nil) e->ent.set_priority(b->ent.priority());
+            drop(b, g);
+            fork(&treap::intersect, l, x0, r, x1, x0, x1, par, g);
+        }
+        if (u == nil) return join(x0, x1);
+        set_left(u, x0);
+        set_right(u, x1);
+        pull(u);
+        return u;
+    }
+    node * subtract(node * a, node * b, int par, node * & g) {
+        if (a == nil || b == nil) {
+            drop_tree(b, g);
+            return a;
+        }
+        node * l, * r, * x0, * x1, * u, * e;
+        if (a->ent.priority() <= b->ent.priority()) {
+            e = split(b, a->ent.key(), l, r);
+            x0 = a->left; x1 = a->right;
+            u = a;
+            if (e != nil) {
+                drop(e, g);
+                drop(a, g);
+                u = nil;
+            }
+            fork(&treap::subtract, x0, l, x1, r, x0, x1, par, g);
+        } else {
+            e = split(a, b->ent.key(), l, r);
+            x0 = b->left; x1 = b->right;
+            u = nil;
+            if (e != nil) drop(e, g);
+            drop(b, g);
+            fork(&treap::subtract, l, x0, r, x1, x0, x1, par, g);
+        }
+        if (u == nil) return join(x0, x1);
+        set_left(u, x0);
+        set_right(u, x1);
+        pull(u);
+        return u;
+    }
+    node * concat(node * a, node * b, int, node * &)
+    { return join(a, b); }
+    // r0 = op(a0, b0) and r1 = op(a1, b1), the first one in a new task
+    // while par > 0 and the halves are large enough to pay for it.
+    void fork(set_op op, node * a0, node * b0, node * a1, node * b1,
+              node * & r0, node * & r1, int par, node * & g) {
+        if (par > 0 && a0->size + b0->size + a1->size + b1->size >= GRAIN) {
+            node * g0 = NULL;
+            future<node *> f = async(launch::async, [=, &g0] {
+                return (this->*op)(a0, b0, par - 1, g0);
+            });
+            r1 = (this->*op)(a1, b1, par - 1, g);
+            r0 = f.get();
+            if (g0 != NULL) {
+                node * t = g0;
+                while (t->par != NULL) t = t->par;
+                t->par = g;
+                g = g0;
+            }
+        } else {
+            r0 = (this->*op)(a0, b0, 0, g);
+            r1 = (this->*op)(a1, b1, 0, g);
+        }
+    }
+    void combine(set_op op, treap<K, V, A> & t) {
+        if (this == &t) {
+            if (op == &treap::subtract) clear();
+            return;
+        }
+        node * b = t._root->left, * h = t._root;
+        pool.splice(t.pool);
+        pool.destroy(h);
+        t.n = 0;
+        t.add_root();
+        int par = 0;
+        for (unsigned c = thread::hardware_concurrency(); c > 1; c >>= 1) par++;
+        node * g = NULL;
+        set_left(_root, (this->*op)(_root->left, b, par, g));
+        n = _root->left->size;
+        while (g != NULL) {
+            node * u = g;
+            g = g->par;
+            make_empty(u);
+        }
+    }
+    node * build(const vector<node *> & v, int l, int r, node * p, int d, int band) {
+        if (l == r) return nil;
+        int m = l + (r - l) / 2;
+        node * u = v[m];
+        u->par = p;
+        u->size = r - l;
+        u->ent.set_priority(d * band + rand() % band);
+        u->left = build(v, l, m, u, d + 1, band);
+        u->right = build(v, m + 1, r, u, d + 1, band);
+        return u;
+    }
+    void destroy_all() {
+        if (!is_trivially_destructible<node>::value || !pool.release())
+            make_empty(_root);
+        _root = NULL;
     }
     void make_empty(node * & p) {
-        if (p != NULL) {
+        if (p != NULL && p != nil) {
             make_empty(p->left);
             make_empty(p->right);
-            delete p;
+            pool.destroy(p);
         }
         p = NULL;
     }
-    node * clone(node * t, node * p) const {
-        if (t == NULL) return NULL;
-        node * r = new node;
+    node * clone(node * t, node * p) {
+        if (t->left == NULL && t->right == NULL) return nil;
+        node * r = pool.create();
         r->ent = t->ent;
         r->par = p;
+        r->size = t->size;
         r->left = clone(t->left, r);
         r->right = clone(t->right, r);
         return r;
     }
 private:
+    A<node> pool;
+    node * nil;
     node * _root;
     int n;
 };
@@ -728,7 +1167,8 @@ private:
  * Height-Balance Property: For every internal node v of T, the heights
  * of the children of v differ by at most 1.
  */
-template <typename K, typename V>
+template <typename K, typename V, template <typename> class A = slab_pool,
+          typename U = null_node_update>
 class avl_tree;
 template <typename K, typename V>
 class avl_entry {
@@ -745,12 +1185,13 @@ public:
     const K & key() const { return _key; }
     const V & value() const { return _value; }
     void set_value(const V & v) { _value = v; }
-    friend class avl_tree<K, V>;
+    template <typename K1, typename V1, template <typename> class A, typename U>
+    friend class avl_tree;
 };
-template <typename K, typename V>
+template <typename K, typename V, template <typename> class A, typename U>
 class avl_tree {
 private:
-    struct node {
+    struct node : public U::data {
         avl_entry<K, V> ent;
         node * par;
         node * left;
@@ -796,35 +1237,38 @@ public:
             ++*this;
             return i;
         }
-        friend class avl_tree<K, V>;
+        friend class avl_tree<K, V, A, U>;
     };
 public:
     avl_tree() : _root(NULL), n(0)
-    { add_root(); expand_external(_root); }
-    avl_tree(const avl_tree<K, V> & st)
-            : _root(clone(st._root, NULL)), n(st.n) { }
-    ~avl_tree() { make_empty(_root); }
-    avl_tree<K, V> & operator=(const avl_tree<K, V> & st) {
-        make_empty(_root);
+    { add_root(); }
+    avl_tree(const avl_tree<K, V, A, U> & st)
+            : nil(pool.create()), _root(clone(st._root, NULL)), n(st.n) { }
+    ~avl_tree() { destroy_all(); }
+    avl_tree<K, V, A, U> & operator=(const avl_tree<K, V, A, U> & st) {
+        if (this == &st) return *this;
+        destroy_all();
+        nil = pool.create();
         _root = clone(st._root, NULL);
         n = st.n;
         return *this;
     }
     void clear() {
+        destroy_all();
         n = 0;
-        make_empty(_root->left->left);
-        make_empty(_root->left->right);
+        add_root();
     }
     iterator find(const K & k) {
-        iterator v = finder(k, root());
+        node * p;
+        iterator v = finder(k, p);
         if (v.is_internal()) return v;
         else return end();
     }
     V & operator[](const K & k) {
-        iterator v = finder(k, root());
+        node * p;
+        iterator v = finder(k, p);
         if (v.is_external()) {
-            expand_external(v);
-            v->set_key(k);
+            v = attach(p, k);
             n++;
             set_height(v);
             rebalance(v);
@@ -840,7 +1284,8 @@ public:
         return v;
     }
     void erase(const K & k) {
-        iterator v = finder(k, root());
+        node * p;
+        iterator v = finder(k, p);
         if (v.is_internal())
             erase(v);
     }
@@ -848,65 +1293,103 @@ public:
         iterator w = eraser(v);
         rebalance(w);
     }
+    /**
+     * Replaces the contents with the sorted range [first, last) of
+     * (key, value) pairs in O(n). The middle key of each range becomes
+     * its root, so all leaves are within one level of each other.
+     * A key not greater than the previous one is skipped.
+     */
+    template <typename I>
+    void build_from_sorted(I first, I last) {
+        clear();
+        vector<node *> v;
+        for (; first != last; ++first) {
+            if (!v.empty() && !(v.back()->ent.key() < first->first)) continue;
+            node * u = pool.create();
+            u->ent.set_key(first->first);
+            u->ent.set_value(first->second);
+            v.push_back(u);
+        }
+        n = v.size();
+        _root->left = build(v, 0, n, _root);
+    }
+    iterator find_by_order(int k)
+    { return k < 0 || k >= n ? end() : iterator(U::select(_root->left, k)); }
+    int order_of_key(const K & k) { return U::rank(_root->left, k); }
     iterator begin() {
-        iterator v = root();
-        while (v.is_internal()) v = v.left();
-        return v.parent();
+        node * v = _root;
+        while (v->left != nil) v = v->left;
+        return iterator(v);
     }
     iterator end() { return _root; }
     int size() const { return n; }
     bool empty() const { return n == 0; }
     iterator root() const { return iterator(_root->left); }
 private:
-    void add_root() { _root = new node; }
-    void expand_external(const iterator & p) {
-        node * v = p.p;
-        v->left = new node;
-        v->left->par = v;
-        v->right = new node;
-        v->right->par = v;
-    }
-    iterator remove_above_external(const iterator & p) {
-        node * w = p.p; node * v = w->par;
-        node * sib = (w == v->left ? v->right : v->left);
-        if (v == _root) {
-            _root = sib;
-            sib->par = NULL;
-        } else {
-            node * gpar = v->par;
-            if (v == gpar->left) gpar->left = sib;
-            else gpar->right = sib;
-            sib->par = gpar;
-        }
-        delete w; delete v;
-        return iterator(sib);
-    }
-    iterator finder(const K & k, const iterator & v) {
-        if (v.is_external()) return v;
-        if (k < v->key()) return finder(k, v.left());
-        else if (v->key() < k) return finder(k, v.right());
-        else return v;
+    // The header _root (whose left child is the root) and the sentinel
+    // nil, which stands for every external node. nil->par is only
+    // meaningful right after an erase, where it is the parent of the hole.
+    void add_root() {
+        nil = pool.create();
+        _root = pool.create();
+        _root->left = _root->right = nil;
+    }
+    // Hangs a new node with key k below p, where finder stopped.
+    iterator attach(node * p, const K & k) {
+        node * v = pool.create();
+        v->ent.set_key(k);
+        v->par = p;
+        v->left = v->right = nil;
+        if (p == _root || k < p->ent.key()) p->left = v;
+        else p->right = v;
+        U::add(v, _root, 1);
+        return iterator(v);
+    }
+    // Unlinks v, which has at most one internal child, and returns the
+    // child that takes its place (nil, with nil->par set, if none).
+    iterator remove_above_external(node * v) {
+        node * c = (v->left != nil ? v->left : v->right);
+        node * p = v->par;
+        if (v == p->left) p->left = c;
+        else p->right = c;
+        c->par = p;
+        pool.destroy(v);
+        return iterator(c);
+    }
+    // The node of k, or nil if there is none; p is its parent.
+    iterator finder(const K & k, node * & p) const {
+        p = _root;
+        node * v = _root->left;
+        while (v != nil)
+            if (k < v->ent.key()) {
+                p = v;
+                v = v->left;
+            } else if (v->ent.key() < k) {
+                p = v;
+                v = v->right;
+            } else break;
+        return iterator(v);
     }
     iterator inserter(const K & k, const V & x) {
-        iterator v = finder(k, root());
+        node * p;
+        iterator v = finder(k, p);
         if (v.is_internal()) return end();
-        expand_external(v);
-        v->set_key(k); v->set_value(x);
+        v = attach(p, k);
+        v->set_value(x);
         n++;
         return v;
     }
     iterator eraser(const iterator & v) {
-        iterator w;
-        if (v.left().is_external()) w = v.left();
-        else if (v.right().is_external()) w = v.right();
-        else {
-            w = v.right();
-            do { w = w.left(); } while (w.is_internal());
-            iterator u = w.parent();
-            v->set_key(u->key()); v->set_value(u->value());
+        node * w = v.p;
+        if (w->left != nil && w->right != nil) {
+            w = w->right;
+            while (w->left != nil) w = w->left;
+            v->set_key(w->ent.key()); v->set_value(w->ent.value());
         }
         n--;
-        return remove_above_external(w);
+        iterator s = remove_above_external(w);
+        U::add(s.p->par, _root, -1);
+        return s;
     }
 private:
     int height(const iterator & v) const
@@ -977,15 +1460,17 @@ private:
         b->left = a;
         a->par = b;
         a->left = T0;
-        T0->par = a;
         a->right = T1;
-        T1->par = a;
         b->right = c;
         c->par = b;
         c->left = T2;
-        T2->par = c;
         c->right = T3;
-        T3->par = c;
+        if (T0 != nil) T0->par = a;
+        if (T1 != nil) T1->par = a;
+        if (T2 != nil) T2->par = c;
+        if (T3 != nil) T3->par = c;
+        U::pull(a); U::pull(c); U::pull(b);
+        COUNT_ROTATIONS(b == y ? 1 : 2);
         return iterator(b);
     }
     void rebalance(const iterator & v) {
@@ -1002,23 +1487,233 @@ private:
             }
         }
     }
+    node * build(const vector<node *> & v, int l, int r, node * p) {
+        if (l == r) return nil;
+        int m = l + (r - l) / 2;
+        node * u = v[m];
+        u->par = p;
+        u->left = build(v, l, m, u);
+        u->right = build(v, m + 1, r, u);
+        set_height(iterator(u));
+        U::pull(u);
+        return u;
+    }
+    void destroy_all() {
+        if (!is_trivially_destructible<node>::value || !pool.release()) {
+            make_empty(_root);
+            pool.destroy(nil);
+        }
+        _root = nil = NULL;
+    }
     void make_empty(node * & p) {
-        if (p != NULL) {
+        if (p != NULL && p != nil) {
             make_empty(p->left);
             make_empty(p->right);
-            delete p;
+            pool.destroy(p);
         }
         p = NULL;
     }
-    node * clone(node * t, node * p) const {
-        if (t == NULL) return NULL;
-        node * r = new node;
+    node * clone(node * t, node * p) {
+        if (t->left == NULL && t->right == NULL) return nil;
+        node * r = pool.create();
         r->ent = t->ent;
         r->par = p;
         r->left = clone(t->left, r);
         r->right = clone(t->right, r);
+        if (r->left != NULL) U::pull(r);
         return r;
     }
+private:
+    A<node> pool;
+    node * nil;
+    node * _root;
+    int n;
+};
+
+/**
+ * Persistent AVL Tree
+ * An AVL tree whose nodes are never changed once built: an update copies
+ * the O(log n) nodes on the path to the changed key and shares all other
+ * subtrees with the old version, so copying the tree (a snapshot) is O(1).
+ * Nodes are reference-counted and freed by whichever version drops the
+ * last reference, so they come from the heap rather than a pool. Each
+ * snapshot may be read, copied and destroyed on its own thread while the
+ * writer keeps updating its tree; one tree object needs one writer.
+ */
+template <typename K, typename V>
+class persistent_avl_tree {
+private:
+    struct node {
+        entry<K, V> ent;
+        node * left;
+        node * right;
+        int ht;
+        atomic<int> ref;
+        node(const entry<K, V> & e, node * lt, node * rt)
+            : ent(e), left(lt), right(rt),
+              ht(max(height(lt), height(rt)) + 1), ref(1) { }
+    };
+public:
+    class iterator {
+    private:
+        // The current node on top of the ancestors still to be visited.
+        vector<const node *> path;
+    public:
+        const entry<K, V> & operator*() const { return path.back()->ent; }
+        const entry<K, V> * operator->() const { return &path.back()->ent; }
+        bool operator==(const iterator & it) const {
+            if (path.empty() || it.path.empty()) return path.empty() == it.path.empty();
+            return path.back() == it.path.back();
+        }
+        bool operator!=(const iterator & it) const
+        { return !(*this == it); }
+        iterator & operator++() {
+            const node * v = path.back()->right;
+            path.pop_back();
+            for (; v != NULL; v = v->left) path.push_back(v);
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator i = *this;
+            ++*this;
+            return i;
+        }
+        friend class persistent_avl_tree<K, V>;
+    };
+public:
+    persistent_avl_tree() : _root(NULL), n(0) { }
+    persistent_avl_tree(const persistent_avl_tree<K, V> & t)
+                       : _root(acquire(t._root)), n(t.n) { }
+    ~persistent_avl_tree() { release(_root); }
+    persistent_avl_tree<K, V> & operator=(const persistent_avl_tree<K, V> & t) {
+        node * r = acquire(t._root);
+        release(_root);
+        _root = r;
+        n = t.n;
+        return *this;
+    }
+    persistent_avl_tree<K, V> snapshot() const { return *this; }
+    iterator find(const K & k) const {
+        iterator it;
+        for (const node * v = _root; v != NULL; )
+            if (k < v->ent.key()) {
+                it.path.push_back(v);
+                v = v->left;
+            } else if (v->ent.key() < k) v = v->right;
+            else {
+                it.path.push_back(v);
+                return it;
+            }
+        return end();
+    }
+    bool contains(const K & k) const {
+        const node * v = _root;
+        while (v != NULL && (k < v->ent.key() || v->ent.key() < k))
+            v = (k < v->ent.key() ? v->left : v->right);
+        return v != NULL;
+    }
+    // Adds k unless it is present; assign also replaces its value.
+    bool insert(const K & k, const V & x) {
+        if (contains(k)) return false;
+        replace(put(_root, k, x));
+        n++;
+        return true;
+    }
+    void assign(const K & k, const V & x) {
+        if (!contains(k)) n++;
+        replace(put(_root, k, x));
+    }
+    bool erase(const K & k) {
+        if (!contains(k)) return false;
+        replace(remove(_root, k));
+        n--;
+        return true;
+    }
+    void clear() {
+        replace(NULL);
+        n = 0;
+    }
+    iterator begin() const {
+        iterator it;
+        for (const node * v = _root; v != NULL; v = v->left)
+            it.path.push_back(v);
+        return it;
+    }
+    iterator end() const { return iterator(); }
+    int size() const { return n; }
+    bool empty() const { return n == 0; }
+private:
+    static int height(const node * u) { return u == NULL ? 0 : u->ht; }
+    static node * acquire(node * u) {
+        if (u != NULL) u->ref.fetch_add(1, memory_order_relaxed);
+        return u;
+    }
+    static void release(node * u) {
+        if (u == NULL || u->ref.fetch_sub(1, memory_order_acq_rel) != 1) return;
+        release(u->left);
+        release(u->right);
+        delete u;
+    }
+    void replace(node * r) {
+        release(_root);
+        _root = r;
+    }
+    // The functions below return a new reference and take over the
+    // references l and r; the subtree u is only read.
+    static node * balance(const entry<K, V> & e, node * l, node * r) {
+        node * res;
+        if (height(l) > height(r) + 1) {
+            if (height(l->left) >= height(l->right))
+                res = new node(l->ent, acquire(l->left), new node(e, acquire(l->right), r));
+            else {
+                node * m = l->right;
+                res = new node(m->ent, new node(l->ent, acquire(l->left), acquire(m->left)),
+                               new node(e, acquire(m->right), r));
+            }
+            release(l);
+        } else if (height(r) > height(l) + 1) {
+            if (height(r->right) >= height(r->left))
+                res = new node(r->ent, new node(e, l, acquire(r->left)), acquire(r->right));
+            else {
+                node * m = r->left;
+                res = new node(m->ent, new node(e, l, acquire(m->left)),
+                               new node(r->ent, acquire(m->right), acquire(r->right)));
+            }
+            release(r);
+        } else res = new node(e, l, r);
+        return res;
+    }
+    static node * put(node * u, const K & k, const V & x) {
+        if (u == NULL) {
+            entry<K, V> e;
+            e.set_key(k);
+            e.set_value(x);
+            return new node(e, NULL, NULL);
+        }
+        if (k < u->ent.key())
+            return balance(u->ent, put(u->left, k, x), acquire(u->right));
+        else if (u->ent.key() < k)
+            return balance(u->ent, acquire(u->left), put(u->right, k, x));
+        entry<K, V> e = u->ent;
+        e.set_value(x);
+        return new node(e, acquire(u->left), acquire(u->right));
+    }
+    // k must be in the subtree u.
+    static node * remove(node * u, const K & k) {
+        if (k < u->ent.key())
+            return balance(u->ent, remove(u->left, k), acquire(u->right));
+        else if (u->ent.key() < k)
+            return balance(u->ent, acquire(u->left), remove(u->right, k));
+        if (u->left == NULL) return acquire(u->right);
+        if (u->right == NULL) return acquire(u->left);
+        node * m = u->right;
+        while (m->left != NULL) m = m->left;
+        return balance(m->ent, acquire(u->left), remove_min(u->right));
+    }
+    static node * remove_min(node * u) {
+        if (u->left == NULL) return acquire(u->right);
+        return balance(u->ent, remove_min(u->left), acquire(u->right));
+    }
 private:
     node * _root;
     int n;
@@ -1037,7 +1732,8 @@ private:
  *   ancestor of itself.)
  */
 enum COLOR { RED, BLACK };
-template <typename K, typename V>
+template <typename K, typename V, template <typename> class A = slab_pool,
+          typename U = null_node_update>
 class rb_tree;
 template <typename K, typename V>
 class rb_entry {
@@ -1056,12 +1752,13 @@ public:
     const K & key() const { return _key; }
     const V & value() const { return _value; }
     void set_value(const V & v) { _value = v; }
-    friend class rb_tree<K, V>;
+    template <typename K1, typename V1, template <typename> class A, typename U>
+    friend class rb_tree;
 };
-template <typename K, typename V>
+template <typename K, typename V, template <typename> class A, typename U>
 class rb_tree {
 private:
-    struct node {
+    struct node : public U::data {
         rb_entry<K, V> ent;
         node * par;
         node * left;
@@ -1107,29 +1804,32 @@ public:
             ++*this;
             return i;
         }
-        friend class rb_tree<K, V>;
+        friend class rb_tree<K, V, A, U>;
     };
 public:
     rb_tree() : _root(NULL), n(0)
-    { add_root(); expand_external(_root); }
-    rb_tree(const rb_tree<K, V> & st)
-           : _root(clone(st._root, NULL)), n(st.n) { }
-    ~rb_tree() { make_empty(_root); }
-    rb_tree & operator=(const rb_tree<K, V> & st) {
-        copy(_root->left, st._root->left);
+    { add_root(); }
+    rb_tree(const rb_tree<K, V, A, U> & st)
+           : nil(pool.create()), _root(clone(st._root, NULL)), n(st.n) { }
+    ~rb_tree() { destroy_all(); }
+    rb_tree & operator=(const rb_tree<K, V, A, U> & st) {
+        if (this == &st) return *this;
+        destroy_all();
+        nil = pool.create();
+        _root = clone(st._root, NULL);
         n = st.n;
         return *this;
     }
     void clear() {
+        destroy_all();
         n = 0;
-        make_empty(_root->left->left);
-        make_empty(_root->left->right);
+        add_root();
     }
     V & operator[](const K & k) {
-        iterator v = finder(k, root());
+        node * p;
+        iterator v = finder(k, p);
         if (v.is_external()) {
-            expand_external(v);
-            v->set_key(k);
+            v = attach(p, k);
             n++;
             if (v == root())
                 set_black(v);
@@ -1141,7 +1841,8 @@ public:
         return v->_value;
     }
     iterator find(const K & k) {
-        iterator v = finder(k, root());
+        node * p;
+        iterator v = finder(k, p);
         if (v.is_internal()) return v;
         else return end();
     }
@@ -1157,7 +1858,8 @@ public:
         return v;
     }
     void erase(const K & k) {
-        iterator u = finder(k, root());
+        node * p;
+        iterator u = finder(k, p);
         if (u.is_internal())
             erase(u);
     }
@@ -1168,66 +1870,104 @@ public:
             set_black(r);
         else remedy_double_black(r);
     }
+    /**
+     * Replaces the contents with the sorted range [first, last) of
+     * (key, value) pairs in O(n). The middle key of each range becomes
+     * its root; the levels above the deepest one are complete and black,
+     * and the nodes on the deepest incomplete level, if any, are red.
+     * A key not greater than the previous one is skipped.
+     */
+    template <typename I>
+    void build_from_sorted(I first, I last) {
+        clear();
+        vector<node *> v;
+        for (; first != last; ++first) {
+            if (!v.empty() && !(v.back()->ent.key() < first->first)) continue;
+            node * u = pool.create();
+            u->ent.set_key(first->first);
+            u->ent.set_value(first->second);
+            v.push_back(u);
+        }
+        n = v.size();
+        int h = 0;
+        while ((2 << h) - 1 <= n) h++;
+        _root->left = build(v, 0, n, _root, 0, h);
+    }
+    iterator find_by_order(int k)
+    { return k < 0 || k >= n ? end() : iterator(U::select(_root->left, k)); }
+    int order_of_key(const K & k) { return U::rank(_root->left, k); }
     iterator begin() {
-        iterator v = root();
-        while (v.is_internal()) v = v.left();
-        return v.parent();
+        node * v = _root;
+        while (v->left != nil) v = v->left;
+        return iterator(v);
     }
     iterator end() { return _root; }
     int size() const { return n; }
     bool empty() const { return n == 0; }
     iterator root() const { return iterator(_root->left); }
 private:
-    void add_root() { _root = new node; }
-    void expand_external(const iterator & p) {
-        node * v = p.p;
-        v->left = new node;
-        v->left->par = v;
-        v->right = new node;
-        v->right->par = v;
-    }
-    iterator remove_above_external(const iterator & p, COLOR & par_col) {
-        node * w = p.p; node * v = w->par;
-        node * sib = (w == v->left ? v->right : v->left);
-        if (v == _root) {
-            _root = sib;
-            sib->par = NULL;
-        } else {
-            node * gpar = v->par;
-            if (v == gpar->left) gpar->left = sib;
-            else gpar->right = sib;
-            sib->par = gpar;
-        }
+    // The header _root (whose left child is the root) and the sentinel
+    // nil, which stands for every external node. nil->par is only
+    // meaningful right after an erase, where it is the parent of the hole.
+    void add_root() {
+        nil = pool.create();
+        _root = pool.create();
+        _root->left = _root->right = nil;
+    }
+    // Hangs a new node with key k below p, where finder stopped.
+    iterator attach(node * p, const K & k) {
+        node * v = pool.create();
+        v->ent.set_key(k);
+        v->par = p;
+        v->left = v->right = nil;
+        if (p == _root || k < p->ent.key()) p->left = v;
+        else p->right = v;
+        U::add(v, _root, 1);
+        return iterator(v);
+    }
+    iterator remove_above_external(node * v, COLOR & par_col) {
+        node * c = (v->left != nil ? v->left : v->right);
+        node * p = v->par;
+        if (v == p->left) p->left = c;
+        else p->right = c;
+        c->par = p;
         par_col = v->ent.color();
-        delete w; delete v;
-        return iterator(sib);
-    }
-    iterator finder(const K & k, const iterator & v) {
-        if (v.is_external()) return v;
-        if (k < v->key()) return finder(k, v.left());
-        else if (v->key() < k) return finder(k, v.right());
-        else return v;
+        pool.destroy(v);
+        return iterator(c);
+    }
+    iterator finder(const K & k, node * & p) const {
+        p = _root;
+        node * v = _root->left;
+        while (v != nil)
+            if (k < v->ent.key()) {
+                p = v;
+                v = v->left;
+            } else if (v->ent.key() < k) {
+                p = v;
+                v = v->right;
+            } else break;
+        return iterator(v);
     }
     iterator inserter(const K & k, const V & x) {
-        iterator v = finder(k, root());
+        node * p;
+        iterator v = finder(k, p);
         if (v.is_internal()) return end();
-        expand_external(v);
-        v->set_key(k); v->set_value(x);
+        v = attach(p, k);
+        v->set_value(x);
         n++;
         return v;
     }
     iterator eraser(const iterator & v, COLOR & par_col) {
-        iterator w;
-        if (v.left().is_external()) w = v.left();
-        else if (v.right().is_external()) w = v.right();
-        else {
-            w = v.right();
-            do { w = w.left(); } while (w.is_internal());
-            iterator u = w.parent();
-            v->set_key(u->key()); v->set_value(u->value());
+        node * w = v.p;
+        if (w->left != nil && w->right != nil) {
+            w = w->right;
+            while (w->left != nil) w = w->left;
+            v->set_key(w->ent.key()); v->set_value(w->ent.value());
         }
         n--;
-        return remove_above_external(w, par_col);
+        iterator s = remove_above_external(w, par_col);
+        U::add(s.p->par, _root, -1);
+        return s;
     }
     iterator restructure(const iterator & p) {
         node * x = p.p, * y = x->par, * z = y->par;
@@ -1274,15 +2014,17 @@ private:
         b->left = a;
         a->par = b;
         a->left = T0;
-        T0->par = a;
         a->right = T1;
-        T1->par = a;
         b->right = c;
         c->par = b;
         c->left = T2;
-        T2->par = c;
         c->right = T3;
-        T3->par = c;
+        if (T0 != nil) T0->par = a;
+        if (T1 != nil) T1->par = a;
+        if (T2 != nil) T2->par = c;
+        if (T3 != nil) T3->par = c;
+        U::pull(a); U::pull(c); U::pull(b);
+        COUNT_ROTATIONS(b == y ? 1 : 2);
         return iterator(b);
     }
     iterator sibling(const iterator & v) const
@@ -1332,43 +2074,425 @@ private:
             remedy_double_black(r);
         }
     }
-    void make_empty(node * & p) const {
-        if (p != NULL) {
+    node * build(const vector<node *> & v, int l, int r, node * p, int d, int h) {
+        if (l == r) return nil;
+        int m = l + (r - l) / 2;
+        node * u = v[m];
+        u->par = p;
+        u->ent.set_color(d < h ? BLACK : RED);
+        u->left = build(v, l, m, u, d + 1, h);
+        u->right = build(v, m + 1, r, u, d + 1, h);
+        U::pull(u);
+        return u;
+    }
+    void destroy_all() {
+        if (!is_trivially_destructible<node>::value || !pool.release()) {
+            make_empty(_root);
+            pool.destroy(nil);
+        }
+        _root = nil = NULL;
+    }
+    void make_empty(node * & p) {
+        if (p != NULL && p != nil) {
             make_empty(p->left);
             make_empty(p->right);
-            delete p;
+            pool.destroy(p);
             p = NULL;
         }
     }
-    node * clone(node * t, node * p) const {
-        if (t == NULL) return NULL;
-        node * r = new node;
+    node * clone(node * t, node * p) {
+        if (t->left == NULL && t->right == NULL) return nil;
+        node * r = pool.create();
         r->ent = t->ent;
         r->par = p;
         r->left = clone(t->left, r);
         r->right = clone(t->right, r);
+        if (r->left != NULL) U::pull(r);
         return r;
     }
-    void copy(node * t, node * src) const {
-        t->ent = src->ent;
-        if (src->left == NULL)
-            make_empty(t->left);
-        else
-        if (t->left == NULL)
-            t->left = clone(src->left, t);
-        else
-            copy(t->left, src->left);
-        if (src->right == NULL)
-            make_empty(t->right);
-        else
-        if (t->right == NULL)
-            t->right = clone(src->right, t);
-        else
-            copy(t->right, src->right);
-    }
 private:
+    A<node> pool;
+    node * nil;
     node * _root;
     int n;
 };
 
+/**
+ * B+ Tree
+ * A B+ tree keeps all entries in leaves holding up to LEAF of them in key
+ * order and chained left to right; an inner node holds up to INNER
+ * separator keys, where child i+1 has keys not less than separator i
+ * and child i has keys less than it. Every node other than the root is
+ * at least half full, so the height is about log(n) / log(INNER / 2).
+ * A leaf, counter and links included, fits in 256 bytes (four cache
+ * lines) unless that leaves room for fewer than 8 entries; an inner node
+ * has 128 bytes of keys. Nodes are searched with a
+ * branchless binary search, so a lookup costs one or two cache misses per
+ * level instead of one per level of a binary tree.
+ * Unlike the binary trees, entries move: insert and erase shift them
+ * inside a leaf and move them between leaves, so both invalidate every
+ * iterator except the one insert returns.
+ */
+template <typename K, typename V, template <typename> class A>
+class b_tree {
+private:
+    enum {
+        INNER = (128 / sizeof(K) < 7 ? 7 : 128 / sizeof(K)) | 1,
+        LEAF_BYTES = 256 - 3 * sizeof(void *), // less cnt, prev and next
+        LEAF = (LEAF_BYTES / sizeof(entry<K, V>) < 8 ? 8 : LEAF_BYTES / sizeof(entry<K, V>)) & ~1
+    };
+    struct leaf {
+        int cnt;
+        leaf * prev;
+        leaf * next;
+        entry<K, V> ent[LEAF];
+        leaf() : cnt(0), prev(NULL), next(NULL) { }
+    };
+    struct inner {
+        int cnt;
+        K key[INNER];
+        void * child[INNER + 1];
+        inner() : cnt(0) { }
+    };
+public:
+    class iterator {
+    private:
+        leaf * p;
+        int i;
+    public:
+        iterator(leaf * _p = NULL, int _i = 0) : p(_p), i(_i) { }
+        entry<K, V> & operator*() { return p->ent[i]; }
+        entry<K, V> & operator*() const { return p->ent[i]; }
+        entry<K, V> * operator->() { return &p->ent[i]; }
+        entry<K, V> * operator->() const { return &p->ent[i]; }
+        bool operator==(const iterator & _p) const
+        { return p == _p.p && i == _p.i; }
+        bool operator!=(const iterator & _p) const
+        { return !(*this == _p); }
+        iterator & operator++() {
+            if (++i == p->cnt) {
+                p = p->next;
+                i = 0;
+            }
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator it = *this;
+            ++*this;
+            return it;
+        }
+        friend class b_tree<K, V, A>;
+    };
+public:
+    b_tree() : _root(NULL), n(0) { add_root(); }
+    b_tree(const b_tree<K, V, A> & bt) : _root(NULL), n(0) { copy(bt); }
+    ~b_tree() { destroy_all(); }
+    b_tree<K, V, A> & operator=(const b_tree<K, V, A> & bt) {
+        if (this == &bt) return *this;
+        destroy_all();
+        copy(bt);
+        return *this;
+    }
+    V & operator[](const K & k) {
+        bool added = false;
+        return locate(k, added)->_value;
+    }
+    iterator find(const K & k) {
+        iterator v = lower_bound(k);
+        if (v != end() && !(k < v->key())) return v;
+        else return end();
+    }
+    iterator insert(const K & k, const V & x) {
+        bool added = false;
+        iterator v = locate(k, added);
+        if (!added) return end();
+        v->set_value(x);
+        return v;
+    }
+    void erase(const K & k) {
+        if (!eraser(_root, height, k)) return;
+        n--;
+        if (height > 0 && ((inner *) _root)->cnt == 0) {
+            inner * r = (inner *) _root;
+            _root = r->child[0];
+            ipool.destroy(r);
+            height--;
+        }
+    }
+    void erase(const iterator & v) {
+        K k = v->key();
+        erase(k);
+    }
+    void clear() {
+        destroy_all();
+        n = 0;
+        add_root();
+    }
+    // The first entry with a key not less than (lower_bound) or greater
+    // than (upper_bound) k.
+    iterator lower_bound(const K & k) {
+        leaf * l = descend(k);
+        int i = rank(l->ent, l->cnt, [&](const entry<K, V> & e) { return e.key() < k; });
+        return at(l, i);
+    }
+    iterator upper_bound(const K & k) {
+        leaf * l = descend(k);
+        int i = rank(l->ent, l->cnt, [&](const entry<K, V> & e) { return !(k < e.key()); });
+        return at(l, i);
+    }
+    iterator begin() { return n == 0 ? end() : iterator(head, 0); }
+    iterator end() { return iterator(); }
+    int size() const { return n; }
+    bool empty() const { return n == 0; }
+private:
+    // Branchless binary search: the number of leading items x among the
+    // first m of a for which before(x) holds, before being true on a
+    // prefix of them and false on the rest.
+    template <typename T, typename F>
+    static int rank(const T * a, int m, F before) {
+        int i = 0;
+        while (m > 1) {
+            int h = m / 2;
+            i = (before(a[i + h - 1]) ? i + h : i);
+            m -= h;
+        }
+        return i + (m == 1 && before(a[i]));
+    }
+    static int child_of(const inner * v, const K & k)
+    { return rank(v->key, v->cnt, [&](const K & x) { return !(k < x); }); }
+    static iterator at(leaf * l, int i) {
+        if (i < l->cnt) return iterator(l, i);
+        return iterator(l->next, 0);
+    }
+    leaf * descend(const K & k) const {
+        void * u = _root;
+        for (int h = height; h > 0; h--) {
+            const inner * v = (const inner *) u;
+            u = v->child[child_of(v, k)];
+        }
+        return (leaf *) u;
+    }
+    // The entry of k, created if there is none (and then added is set).
+    // Full nodes on the way down are split first, so there is always room
+    // for a separator coming up from below.
+    iterator locate(const K & k, bool & added) {
+        if (full(_root, height)) {
+            inner * r = ipool.create();
+            r->child[0] = _root;
+            split_child(r, 0, height);
+            _root = r;
+            height++;
+        }
+        void * u = _root;
+        for (int h = height; h > 0; h--) {
+            inner * v = (inner *) u;
+            int i = child_of(v, k);
+            if (full(v->child[i], h - 1)) {
+                split_child(v, i, h - 1);
+                if (!(k < v->key[i])) i++;
+            }
+            u = v->child[i];
+        }
+        leaf * l = (leaf *) u;
+        int i = rank(l->ent, l->cnt, [&](const entry<K, V> & e) { return e.key() < k; });
+        if (i < l->cnt && !(k < l->ent[i].key())) return iterator(l, i);
+        for (int j = l->cnt; j > i; j--)
+            l->ent[j] = std::move(l->ent[j - 1]);
+        l->ent[i].set_key(k);
+        l->ent[i].set_value(V());
+        l->cnt++;
+        n++;
+        added = true;
+        return iterator(l, i);
+    }
+    static bool full(void * u, int h)
+    { return h == 0 ? ((leaf *) u)->cnt == LEAF : ((inner *) u)->cnt == INNER; }
+    // Splits the full child i of v in two halves and adds the separator
+    // between them to v, which is not full.
+    void split_child(inner * v, int i, int h) {
+        K sep;
+        void * d;
+        if (h == 0) {
+            leaf * a = (leaf *) v->child[i], * b = lpool.create();
+            for (int j = 0; j < LEAF / 2; j++)
+                b->ent[j] = std::move(a->ent[LEAF / 2 + j]);
+            a->cnt = b->cnt = LEAF / 2;
+            b->next = a->next;
+            if (b->next != NULL) b->next->prev = b;
+            b->prev = a;
+            a->next = b;
+            sep = b->ent[0].key();
+            d = b;
+        } else {
+            inner * a = (inner *) v->child[i], * b = ipool.create();
+            int t = INNER / 2;
+            for (int j = 0; j < t; j++)
+                b->key[j] = std::move(a->key[t + 1 + j]);
+            for (int j = 0; j <= t; j++)
+                b->child[j] = a->child[t + 1 + j];
+            sep = std::move(a->key[t]);
+            a->cnt = b->cnt = t;
+            d = b;
+        }
+        for (int j = v->cnt; j > i; j--) {
+            v->key[j] = std::move(v->key[j - 1]);
+            v->child[j + 1] = v->child[j];
+        }
+        v->key[i] = std::move(sep);
+        v->child[i + 1] = d;
+        v->cnt++;
+    }
+    bool eraser(void * u, int h, const K & k) {
+        if (h == 0) {
+            leaf * l = (leaf *) u;
+            int i = rank(l->ent, l->cnt, [&](const entry<K, V> & e) { return e.key() < k; });
+            if (i == l->cnt || k < l->ent[i].key()) return false;
+            for (int j = i + 1; j < l->cnt; j++)
+                l->ent[j - 1] = std::move(l->ent[j]);
+            l->ent[--l->cnt] = entry<K, V>();
+            return true;
+        }
+        inner * v = (inner *) u;
+        int i = child_of(v, k);
+        if (!eraser(v->child[i], h - 1, k)) return false;
+        if (underfull(v->child[i], h - 1)) remedy(v, i, h - 1);
+        return true;
+    }
+    static bool underfull(void * u, int h)
+    { return h == 0 ? ((leaf *) u)->cnt < LEAF / 2 : ((inner *) u)->cnt < INNER / 2; }
+    // Child i of v has one entry (key) too few: it takes one from a
+    // sibling that can spare it, or else is merged with that sibling.
+    void remedy(inner * v, int i, int h) {
+        int j = (i > 0 ? i - 1 : 0);
+        void * s = v->child[i > 0 ? i - 1 : 1];
+        bool spare = (h == 0 ? ((leaf *) s)->cnt > LEAF / 2 : ((inner *) s)->cnt > INNER / 2);
+        if (!spare) merge(v, j, h);
+        else if (i > 0) rotate_right(v, j, h);
+        else rotate_left(v, j, h);
+    }
+    // Moves the last entry of child j of v to the front of child j+1.
+    void rotate_right(inner * v, int j, int h) {
+        if (h == 0) {
+            leaf * a = (leaf *) v->child[j], * b = (leaf *) v->child[j + 1];
+            for (int t = b->cnt; t > 0; t--)
+                b->ent[t] = std::move(b->ent[t - 1]);
+            b->ent[0] = std::move(a->ent[--a->cnt]);
+            b->cnt++;
+            v->key[j] = b->ent[0].key();
+        } else {
+            inner * a = (inner *) v->child[j], * b = (inner *) v->child[j + 1];
+            b->child[b->cnt + 1] = b->child[b->cnt];
+            for (int t = b->cnt; t > 0; t--) {
+                b->key[t] = std::move(b->key[t - 1]);
+                b->child[t] = b->child[t - 1];
+            }
+            b->key[0] = std::move(v->key[j]);
+            b->child[0] = a->child[a->cnt];
+            b->cnt++;
+            v->key[j] = std::move(a->key[--a->cnt]);
+        }
+    }
+    // Moves the first entry of child j+1 of v to the back of child j.
+    void rotate_left(inner * v, int j, int h) {
+        if (h == 0) {
+            leaf * a = (leaf *) v->child[j], * b = (leaf *) v->child[j + 1];
+            a->ent[a->cnt++] = std::move(b->ent[0]);
+            for (int t = 1; t < b->cnt; t++)
+                b->ent[t - 1] = std::move(b->ent[t]);
+            b->cnt--;
+            v->key[j] = b->ent[0].key();
+        } else {
+            inner * a = (inner *) v->child[j], * b = (inner *) v->child[j + 1];
+            a->key[a->cnt] = std::move(v->key[j]);
+            a->child[++a->cnt] = b->child[0];
+            v->key[j] = std::move(b->key[0]);
+            for (int t = 1; t < b->cnt; t++)
+                b->key[t - 1] = std::move(b->key[t]);
+            for (int t = 1; t <= b->cnt; t++)
+                b->child[t - 1] = b->child[t];
+            b->cnt--;
+        }
+    }
+    // Appends child j+1 of v to child j and removes it from v.
+    void merge(inner * v, int j, int h) {
+        if (h == 0) {
+            leaf * a = (leaf *) v->child[j], * b = (leaf *) v->child[j + 1];
+            for (int t = 0; t < b->cnt; t++)
+                a->ent[a->cnt++] = std::move(b->ent[t]);
+            a->next = b->next;
+            if (a->next != NULL) a->next->prev = a;
+            lpool.destroy(b);
+        } else {
+            inner * a = (inner *) v->child[j], * b = (inner *) v->child[j + 1];
+            a->key[a->cnt] = std::move(v->key[j]);
+            for (int t = 0; t < b->cnt; t++) {
+                a->key[a->cnt + 1 + t] = std::move(b->key[t]);
+                a->child[a->cnt + 1 + t] = b->child[t];
+            }
+            a->child[a->cnt + 1 + b->cnt] = b->child[b->cnt];
+            a->cnt += 1 + b->cnt;
+            ipool.destroy(b);
+        }
+        for (int t = j + 1; t < v->cnt; t++) {
+            v->key[t - 1] = std::move(v->key[t]);
+            v->child[t] = v->child[t + 1];
+        }
+        v->cnt--;
+    }
+private:
+    void add_root() {
+        head = lpool.create();
+        _root = head;
+        height = 0;
+    }
+    void copy(const b_tree<K, V, A> & bt) {
+        leaf * last = NULL;
+        height = bt.height;
+        _root = clone(bt._root, height, last);
+        n = bt.n;
+    }
+    void * clone(void * u, int h, leaf * & last) {
+        if (h == 0) {
+            leaf * l = (leaf *) u, * r = lpool.create();
+            r->cnt = l->cnt;
+            for (int j = 0; j < l->cnt; j++)
+                r->ent[j] = l->ent[j];
+            r->prev = last;
+            if (last != NULL) last->next = r;
+            else head = r;
+            last = r;
+            return r;
+        }
+        inner * v = (inner *) u, * r = ipool.create();
+        r->cnt = v->cnt;
+        for (int j = 0; j < v->cnt; j++)
+            r->key[j] = v->key[j];
+        for (int j = 0; j <= v->cnt; j++)
+            r->child[j] = clone(v->child[j], h - 1, last);
+        return r;
+    }
+    void destroy_all() {
+        if (!is_trivially_destructible<leaf>::value || !lpool.release() || !ipool.release())
+            make_empty(_root, height);
+        _root = head = NULL;
+    }
+    void make_empty(void * u, int h) {
+        if (h == 0) {
+            lpool.destroy((leaf *) u);
+            return;
+        }
+        inner * v = (inner *) u;
+        for (int j = 0; j <= v->cnt; j++)
+            make_empty(v->child[j], h - 1);
+        ipool.destroy(v);
+    }
+private:
+    A<leaf> lpool;
+    A<inner> ipool;
+    void * _root;
+    leaf * head;
+    int height;
+    int n;
+};
+
 #endif // _SEARCH_TREE_H
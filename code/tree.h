@@ -129,6 +129,7 @@ private:
     int size(node * t) const
     { return t == NULL ? 0 : t->size; }
     void rotate_with_left_child(node * & k2) {
+        COUNT_ROTATIONS(1);
         node * k1 = k2->left;
         k2->left = k1->right;
         k1->right = k2;
@@ -139,6 +140,7 @@ private:
         k2 = k1;
     }
     void rotate_with_right_child(node * & k1) {
+        COUNT_ROTATIONS(1);
         node * k2 = k1->right;
         k1->right = k2->left;
         k2->left = k1;
@@ -292,6 +294,7 @@ private:
     int size(node * t) const
     { return t == NULL ? 0 : t->size; }
     void rotate_with_left_child(node * & k2) {
+        COUNT_ROTATIONS(1);
         node * k1 = k2->left;
         k2->left = k1->right;
         k1->right = k2;
@@ -300,6 +303,7 @@ private:
         k2 = k1;
     }
     void rotate_with_right_child(node * & k1) {
+        COUNT_ROTATIONS(1);
         node * k2 = k1->right;
         k1->right = k2->left;
         k2->left = k1;
@@ -530,6 +534,7 @@ private:
         }
     }
     void rotate_with_left_child(node * k2) {
+        COUNT_ROTATIONS(1);
         node * p = k2->parent;
         node * k1 = k2->left;
         push_down(k2); push_down(k1);
@@ -548,6 +553,7 @@ private:
         k1->size = size(k1->left) + size(k1->right) + 1;
     }
     void rotate_with_right_child(node * k1) {
+        COUNT_ROTATIONS(1);
         node * p = k1->parent;
         node * k2 = k1->right;
         push_down(k1); push_down(k2);
@@ -1443,6 +1449,7 @@ class treap {
         s[top++] = x;
     }
     void rotate_left(int & o) {
+        COUNT_ROTATIONS(1);
         int k = ls[o];
         ls[o] = rs[k];
         sz[o] = sz[ls[o]] + cnt[o] + sz[rs[o]];
@@ -1451,6 +1458,7 @@ class treap {
         sz[o] = sz[ls[o]] + cnt[o] + sz[rs[o]];
     }
     void rotate_right(int & o) {
+        COUNT_ROTATIONS(1);
         int k = rs[o];
         rs[o] = ls[k];
         sz[o] = sz[ls[o]] + cnt[o] + sz[rs[o]];